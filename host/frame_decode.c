@@ -0,0 +1,134 @@
+/*
+===============================================================================
+ Name        : frame_decode.c
+ Description : Host side decoder for binary frames (see inc/frame.h). Reads a
+ captured byte stream, checks each frame's CRC and writes the samples as
+ "record-number adc-value" lines, like OUTPUT_FORMAT_TEXT. FRAME_TYPE_PACKED12,
+ FRAME_TYPE_RAW16 and FRAME_TYPE_RICE frames are decoded; other frames are
+ counted and skipped. A summary with the compression ratio goes to stderr.
+
+ Usage: frame_decode [capture.bin] > capture.dat
+
+ The summary includes the loss counters from the last frame header.
+===============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "rice.h"
+
+// Largest payload: 1024 RAW16 samples
+#define PAYLOAD_MAX 2048
+
+/**
+ * @brief Decode the samples of a frame.
+ * @param h Header
+ * @param payload Payload, h->payload_len bytes
+ * @param out Samples
+ * @return 0 if ok, -1 if not a sample frame or the payload is invalid
+ */
+static int decode_samples (const FRAME_HEADER_T *h, const uint8_t *payload, uint16_t *out)
+{
+	int n = h->sample_count;
+	int i;
+
+	switch (h->type) {
+	case FRAME_TYPE_PACKED12:
+		if (h->payload_len != frame_packed12_len(n)) {
+			return -1;
+		}
+		frame_unpack12(payload, n, out);
+		return 0;
+	case FRAME_TYPE_RAW16:
+		if (h->payload_len != 2 * n) {
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			out[i] = (payload[2*i] | (payload[2*i+1] << 8)) >> 4;
+		}
+		return 0;
+	case FRAME_TYPE_RICE:
+		return rice_decode(payload, h->payload_len, out, n, frame_channel_count(h->chan_mask));
+	default:
+		return -1;
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	static uint8_t payload[PAYLOAD_MAX];
+	static uint16_t samples[PAYLOAD_MAX];
+	uint8_t hdr[FRAME_HEADER_LEN];
+	unsigned long frames = 0, skipped = 0, bad = 0, resync = 0;
+	unsigned long long sample_bytes = 0, packed_bytes = 0;
+	unsigned long record = 0;
+	FRAME_HEADER_T last = {0};
+	FILE *f = stdin;
+	int fill = 0;
+
+	if (argc > 1 && (f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	while (1) {
+		FRAME_HEADER_T h;
+		uint16_t crc;
+		int c, i, nchan;
+
+		// Find sync: keep the last FRAME_HEADER_LEN bytes
+		while (fill < FRAME_HEADER_LEN && (c = getc(f)) != EOF) {
+			hdr[fill++] = c;
+		}
+		if (fill < FRAME_HEADER_LEN) {
+			break;
+		}
+		if (frame_header_read(hdr, &h) != 0 || h.version != FRAME_VERSION
+				|| h.payload_len > PAYLOAD_MAX || h.sample_count > PAYLOAD_MAX) {
+			memmove(hdr, hdr + 1, --fill);
+			resync++;
+			continue;
+		}
+		if (fread(payload, 1, h.payload_len, f) != h.payload_len) {
+			break;
+		}
+		fill = 0;
+
+		crc = frame_crc16(0xFFFF, &hdr[FRAME_CRC_START], FRAME_CRC_END - FRAME_CRC_START);
+		crc = frame_crc16(crc, payload, h.payload_len);
+		if (crc != h.crc) {
+			bad++;
+			continue;
+		}
+		frames++;
+		last = h;
+
+		if (decode_samples(&h, payload, samples) != 0) {
+			skipped++;
+			continue;
+		}
+		sample_bytes += h.payload_len;
+		packed_bytes += frame_packed12_len(h.sample_count);
+
+		nchan = frame_channel_count(h.chan_mask);
+		for (i = 0; i + nchan <= h.sample_count; i += nchan) {
+			printf("%lu", record++);
+			for (c = 0; c < nchan; c++) {
+				printf(" %u", samples[i + c]);
+			}
+			printf("\n");
+		}
+	}
+
+	fprintf(stderr, "%lu frames, %lu not samples, %lu bad crc, %lu bytes skipped\n",
+			frames, skipped, bad, resync);
+	fprintf(stderr, "adc overruns %u, lost blocks %u\n", last.adc_overruns, last.lost_blocks);
+	if (sample_bytes > 0) {
+		fprintf(stderr, "compression ratio vs packed 12 bit %.3f\n",
+				(double)packed_bytes / sample_bytes);
+	}
+	return 0;
+}
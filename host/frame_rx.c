@@ -0,0 +1,464 @@
+/*
+===============================================================================
+ Name        : frame_rx.c
+ Description : Host side receiver for binary frames (see inc/frame.h), for
+ live capture from a serial port or from a pipe (eg an SPI bridge tool's
+ output). Syncs to the frame stream, checks each frame's CRC and the sequence
+ numbers, decodes FRAME_TYPE_PACKED12, FRAME_TYPE_RAW16 and FRAME_TYPE_RICE
+ frames, and writes the samples to a binary file that can be memory mapped
+ and/or to "record-number adc-value" text like data/capture.dat. Throughput
+ and loss are reported on stderr every interval.
+
+ Usage: frame_rx [-d device] [-b baud] [-o capture.bin] [-t capture.dat]
+                 [-i seconds] [input]
+
+ -d reads from a serial port, set to raw 8N1 at -b baud (default 115200),
+ otherwise the input file or stdin is read. Stop with Ctrl-C.
+
+ Binary file: a 32 byte little-endian header, then 16 bit little-endian
+ samples (12 bit values) interleaved by channel in ascending channel order:
+   0  8  magic "LPCADC16"
+   8  4  version (1)
+  12  4  sample rate per channel of the first frame, Hz
+  16  2  channel mask of the first frame
+  18  2  number of channels
+  20  4  reserved (0)
+  24  8  number of records (one sample per channel each), set on exit
+ Blocks lost on the link (gaps in the frame sequence numbers) are filled
+ with FRX_GAP_SAMPLE so that sample n is still at time n / rate; gaps in text
+ output are "# lost" comment lines and the record numbers skip ahead.
+ A change of rate or channels during capture is reported but doesn't change
+ the header, as eg the back-pressure decimate policy changes the rate of
+ single frames.
+
+ Reading and parsing is done from a 1MiB buffer with one read() per chunk,
+ and output is formatted by hand into large stdio buffers: several MB/s,
+ well above 3Mbaud UART or 15MHz SPI.
+===============================================================================
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "rice.h"
+
+// Largest payload accepted (UART_DMA_MAX_PAYLOAD, SPI_DMA_MAX_PAYLOAD) and
+// samples per frame. Anything larger is taken as a false sync.
+#define FRX_PAYLOAD_MAX 5120
+#define FRX_SAMPLES_MAX 4096
+
+// Input buffer. Compacted once half of it has been parsed.
+#define FRX_BUF_SIZE (1 << 20)
+// Output stdio buffers
+#define FRX_OUT_BUF_SIZE (1 << 20)
+
+// Binary file: fill for samples of lost blocks, never a 12 bit value
+#define FRX_GAP_SAMPLE 0xFFFF
+#define FRX_BIN_HEADER_LEN 32
+// Longest gap that is filled, in samples. Longer gaps are just counted.
+#define FRX_GAP_MAX (1 << 24)
+
+typedef struct {
+	unsigned long long bytes;		// Bytes received
+	unsigned long long records;		// Records written
+	unsigned long frames;			// Frames with a good CRC
+	unsigned long other;			// Good frames that are not 12 bit samples
+	unsigned long bad_crc;
+	unsigned long skipped;			// Bytes skipped to find sync
+	unsigned long lost;				// Frames missing from the sequence numbers
+	unsigned long restarts;			// Sequence number went backwards
+	unsigned long changes;			// Rate or channel changes
+} FRX_STATS_T;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal (int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static double now_s (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static speed_t baud_speed (long baud)
+{
+	static const struct { long baud; speed_t speed; } speeds[] = {
+		{9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+		{115200, B115200}, {230400, B230400},
+#ifdef B460800
+		{460800, B460800}, {500000, B500000}, {576000, B576000},
+		{921600, B921600}, {1000000, B1000000}, {1152000, B1152000},
+		{1500000, B1500000}, {2000000, B2000000}, {2500000, B2500000},
+		{3000000, B3000000},
+#endif
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+		if (speeds[i].baud == baud) {
+			return speeds[i].speed;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Open a serial port raw 8N1, no flow control.
+ * @return File descriptor, -1 on error (reported)
+ */
+static int serial_open (const char *dev, long baud)
+{
+	struct termios t;
+	speed_t speed = baud_speed(baud);
+	int fd;
+
+	if (speed == 0) {
+		fprintf(stderr, "%s: unsupported baud rate %ld\n", dev, baud);
+		return -1;
+	}
+	if ((fd = open(dev, O_RDONLY | O_NOCTTY)) < 0 || tcgetattr(fd, &t) != 0) {
+		perror(dev);
+		return -1;
+	}
+	t.c_iflag = 0;
+	t.c_oflag = 0;
+	t.c_lflag = 0;
+	t.c_cflag = CS8 | CREAD | CLOCAL;
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	cfsetispeed(&t, speed);
+	cfsetospeed(&t, speed);
+	if (tcsetattr(fd, TCSANOW, &t) != 0) {
+		perror(dev);
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+static void put_le (uint8_t *p, uint64_t v, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		p[i] = v >> (8 * i);
+	}
+}
+
+static void bin_header (FILE *f, const FRAME_HEADER_T *first, unsigned long long records)
+{
+	uint8_t h[FRX_BIN_HEADER_LEN] = "LPCADC16";
+
+	put_le(&h[8], 1, 4);
+	put_le(&h[12], first->sample_rate, 4);
+	put_le(&h[16], first->chan_mask, 2);
+	put_le(&h[18], frame_channel_count(first->chan_mask), 2);
+	put_le(&h[20], 0, 4);
+	put_le(&h[24], records, 8);
+	fwrite(h, 1, sizeof(h), f);
+}
+
+static void bin_samples (FILE *f, const uint16_t *s, int n)
+{
+	uint8_t out[2 * FRX_SAMPLES_MAX];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		out[2*i] = s[i];
+		out[2*i+1] = s[i] >> 8;
+	}
+	fwrite(out, 2, n, f);
+}
+
+/**
+ * @brief Format an unsigned number, faster than printf.
+ * @return Pointer after the last digit
+ */
+static char *fmt_u (char *p, unsigned long long v)
+{
+	char tmp[20];
+	int i = 0;
+
+	do {
+		tmp[i++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (i) {
+		*p++ = tmp[--i];
+	}
+	return p;
+}
+
+static void text_samples (FILE *f, const uint16_t *s, int n, int nchan, unsigned long long record)
+{
+	char line[8 + 20 + 6 * 16];
+	int i, c;
+
+	for (i = 0; i + nchan <= n; i += nchan) {
+		char *p = fmt_u(line, record++);
+		for (c = 0; c < nchan; c++) {
+			*p++ = ' ';
+			p = fmt_u(p, s[i + c]);
+		}
+		*p++ = '\n';
+		fwrite(line, 1, p - line, f);
+	}
+}
+
+/**
+ * @brief Decode the samples of a frame.
+ * @param h Header
+ * @param payload Payload, h->payload_len bytes
+ * @param out Samples
+ * @return 0 if ok, -1 if not a sample frame or the payload is invalid
+ */
+static int decode_samples (const FRAME_HEADER_T *h, const uint8_t *payload, uint16_t *out)
+{
+	int n = h->sample_count;
+	int i;
+
+	switch (h->type) {
+	case FRAME_TYPE_PACKED12:
+		if (h->payload_len != frame_packed12_len(n)) {
+			return -1;
+		}
+		frame_unpack12(payload, n, out);
+		return 0;
+	case FRAME_TYPE_RAW16:
+		if (h->payload_len != 2 * n) {
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			out[i] = (payload[2*i] | (payload[2*i+1] << 8)) >> 4;
+		}
+		return 0;
+	case FRAME_TYPE_RICE:
+		return rice_decode(payload, h->payload_len, out, n, frame_channel_count(h->chan_mask));
+	default:
+		return -1;
+	}
+}
+
+static void report (const FRX_STATS_T *st, const FRAME_HEADER_T *last, double dt,
+		unsigned long long bytes, unsigned long long records)
+{
+	fprintf(stderr, "rx %.3f MB/s %.0f samples/s | frames %lu other %lu bad_crc %lu"
+			" skipped %lu lost %lu restarts %lu | fw adc_overruns %u lost_blocks %u\n",
+			bytes / dt / 1e6, records / dt * frame_channel_count(last->chan_mask),
+			st->frames, st->other, st->bad_crc, st->skipped, st->lost, st->restarts,
+			last->adc_overruns, last->lost_blocks);
+}
+
+int main (int argc, char *argv[])
+{
+	static uint8_t buf[FRX_BUF_SIZE];
+	static uint16_t samples[FRX_SAMPLES_MAX];
+	static uint16_t gap[FRX_SAMPLES_MAX];
+	const char *dev = NULL, *bin_name = NULL, *text_name = NULL;
+	FILE *bin = NULL, *text = NULL;
+	long baud = 115200;
+	double interval = 1.0, t0, t_report;
+	unsigned long long bytes_report = 0, records_report = 0;
+	FRX_STATS_T st = {0};
+	FRAME_HEADER_T first = {0}, last = {0};
+	uint32_t seq = 0, rate = 0;
+	int have_seq = 0;
+	size_t pos = 0, end = 0;
+	struct sigaction sa;
+	int fd = 0, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:b:o:t:i:")) != -1) {
+		switch (opt) {
+		case 'd': dev = optarg; break;
+		case 'b': baud = strtol(optarg, NULL, 0); break;
+		case 'o': bin_name = optarg; break;
+		case 't': text_name = optarg; break;
+		case 'i': interval = strtod(optarg, NULL); break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-b baud] [-o capture.bin] [-t capture.dat]"
+					" [-i seconds] [input]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (dev) {
+		if ((fd = serial_open(dev, baud)) < 0) {
+			return 1;
+		}
+	} else if (optind < argc && strcmp(argv[optind], "-") != 0
+			&& (fd = open(argv[optind], O_RDONLY)) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (bin_name && (bin = fopen(strcmp(bin_name, "-") ? bin_name : "/dev/stdout", "wb")) == NULL) {
+		perror(bin_name);
+		return 1;
+	}
+	if (text_name && (text = fopen(strcmp(text_name, "-") ? text_name : "/dev/stdout", "w")) == NULL) {
+		perror(text_name);
+		return 1;
+	}
+	if (bin) {
+		setvbuf(bin, NULL, _IOFBF, FRX_OUT_BUF_SIZE);
+	}
+	if (text) {
+		setvbuf(text, NULL, _IOFBF, FRX_OUT_BUF_SIZE);
+	}
+	for (i = 0; i < FRX_SAMPLES_MAX; i++) {
+		gap[i] = FRX_GAP_SAMPLE;
+	}
+
+	// No SA_RESTART: Ctrl-C interrupts a blocking read()
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	t0 = t_report = now_s();
+	while ( ! stop) {
+		ssize_t got;
+		double t;
+
+		// Keep room for a whole frame after the unparsed bytes
+		if (pos > FRX_BUF_SIZE / 2) {
+			memmove(buf, buf + pos, end - pos);
+			end -= pos;
+			pos = 0;
+		}
+		got = read(fd, buf + end, FRX_BUF_SIZE - end);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			if (got < 0) {
+				perror("read");
+			}
+			break;
+		}
+		end += got;
+		st.bytes += got;
+
+		while (end - pos >= FRAME_HEADER_LEN) {
+			const uint8_t *p = buf + pos;
+			FRAME_HEADER_T h;
+			uint16_t crc;
+			int nchan;
+
+			if (frame_header_read(p, &h) != 0 || h.version != FRAME_VERSION
+					|| h.payload_len > FRX_PAYLOAD_MAX || h.sample_count > FRX_SAMPLES_MAX) {
+				// Skip to the next possible sync
+				const uint8_t *s = memchr(p + 1, FRAME_SYNC & 0xFF, end - pos - 1);
+				size_t n = s ? (size_t)(s - p) : end - pos;
+				st.skipped += n;
+				pos += n;
+				continue;
+			}
+			if (end - pos < (size_t)FRAME_HEADER_LEN + h.payload_len) {
+				break;
+			}
+			crc = frame_crc16(0xFFFF, &p[FRAME_CRC_START], FRAME_CRC_END - FRAME_CRC_START);
+			crc = frame_crc16(crc, p + FRAME_HEADER_LEN, h.payload_len);
+			if (crc != h.crc) {
+				// False sync, or a damaged frame: look for sync from the next byte
+				st.bad_crc++;
+				st.skipped++;
+				pos++;
+				continue;
+			}
+			pos += FRAME_HEADER_LEN + h.payload_len;
+			st.frames++;
+			last = h;
+
+			if (decode_samples(&h, p + FRAME_HEADER_LEN, samples) != 0) {
+				st.other++;
+				continue;
+			}
+			nchan = frame_channel_count(h.chan_mask);
+
+			if ( ! have_seq) {
+				first = h;
+				have_seq = 1;
+				if (bin) {
+					bin_header(bin, &first, 0);
+				}
+			} else {
+				if ((h.sample_rate != rate || h.chan_mask != first.chan_mask) && st.changes++ == 0) {
+					fprintf(stderr, "rate or channels changed: %u Hz mask 0x%x\n",
+							h.sample_rate, h.chan_mask);
+				}
+				// Trigger windows send several frames with the same seq
+				if (h.seq > seq + 1) {
+					unsigned long missing = h.seq - seq - 1;
+					unsigned long long fill = (unsigned long long)missing * h.sample_count;
+
+					st.lost += missing;
+					if (fill <= FRX_GAP_MAX) {
+						if (bin) {
+							for (; fill > FRX_SAMPLES_MAX; fill -= FRX_SAMPLES_MAX) {
+								bin_samples(bin, gap, FRX_SAMPLES_MAX);
+							}
+							bin_samples(bin, gap, fill);
+						}
+						if (text) {
+							fprintf(text, "# lost %lu\n", missing);
+						}
+						st.records += (unsigned long long)missing * h.sample_count / nchan;
+					}
+				} else if (h.seq < seq) {
+					st.restarts++;
+				}
+			}
+			seq = h.seq;
+			rate = h.sample_rate;
+
+			if (bin) {
+				bin_samples(bin, samples, h.sample_count - h.sample_count % nchan);
+			}
+			if (text) {
+				text_samples(text, samples, h.sample_count, nchan, st.records);
+			}
+			st.records += h.sample_count / nchan;
+		}
+
+		t = now_s();
+		if (interval > 0 && t - t_report >= interval) {
+			report(&st, &last, t - t_report, st.bytes - bytes_report, st.records - records_report);
+			t_report = t;
+			bytes_report = st.bytes;
+			records_report = st.records;
+		}
+	}
+	t0 = now_s() - t0;
+	if (text) {
+		fclose(text);
+	}
+	if (bin) {
+		// Record count in the header, if the output can seek
+		if (have_seq && fseek(bin, 0, SEEK_SET) == 0) {
+			bin_header(bin, &first, st.records);
+		}
+		fclose(bin);
+	}
+	fprintf(stderr, "total: %llu bytes in %.1f s, %llu records\n", st.bytes, t0, st.records);
+	report(&st, &last, t0 > 0 ? t0 : 1, st.bytes, st.records);
+	if (st.changes > 0) {
+		fprintf(stderr, "%lu frames with a different rate or channels\n", st.changes);
+	}
+	return 0;
+}
@@ -0,0 +1,297 @@
+/*
+===============================================================================
+ Name        : mtb_decode.c
+ Description : Host side decoder for MTB traces (FRAME_TYPE_TRACE frames, see
+ inc/mtb_trace.h). Reads the disassembly of the firmware and a captured byte
+ stream, and prints the number of instructions executed in each function,
+ summed over all the traces in the capture, busiest first.
+
+ Usage: arm-none-eabi-objdump -d Debug/LPC824_ADC_DMA_example.axf > listing.txt
+        mtb_decode listing.txt [capture.bin]
+
+ Each packet is a branch from a source to a destination address. Between the
+ destination of one packet and the source of the next the core ran in
+ sequence, so those are the instructions of the listing in that address
+ range. The source is included, except for an exception entry, where it is the
+ interrupted instruction, which hasn't run yet. The runs before the first
+ packet of a trace and after the last aren't known, nor across a point
+ where tracing was stopped and started again (bit 0 of the destination word
+ set), and are skipped. So are runs that don't make sense for the listing
+ (other firmware, or a corrupt packet), which are counted as bad.
+===============================================================================
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "mtb_trace.h"
+
+// Largest payload: a trace buffer the size of the SRAM
+#define PAYLOAD_MAX 8192
+
+// Longest plausible run of sequential code in bytes
+#define RUN_MAX 4096
+
+#define FN_NAME_MAX 64
+
+typedef struct {
+	unsigned long addr;
+	int fn;			// Index in fns
+	int ret;		// Returns from a function or exception: pop {..., pc} or bx
+} INSTR_T;
+
+typedef struct {
+	char name[FN_NAME_MAX];
+	unsigned long long count;	// Instructions executed
+	unsigned long calls;		// Packets with the first instruction as destination
+	unsigned long addr;
+} FN_T;
+
+static INSTR_T *instrs;
+static int numInstrs, maxInstrs;
+static FN_T *fns;
+static int numFns, maxFns;
+
+/**
+ * @brief Add a function or an instruction, growing the array as needed.
+ */
+static void *grow (void *p, int n, int *max, size_t size)
+{
+	if (n < *max) {
+		return p;
+	}
+	*max = *max ? 2 * *max : 1024;
+	p = realloc(p, *max * size);
+	if (p == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+	return p;
+}
+
+static int instr_cmp (const void *a, const void *b)
+{
+	const INSTR_T *x = a, *y = b;
+
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int fn_cmp (const void *a, const void *b)
+{
+	const FN_T *x = a, *y = b;
+
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+/**
+ * @brief Read an objdump -d listing: function labels "00000100 <main>:" and
+ * instruction lines "     10c:\tb510      \tpush\t{r4, lr}". Data in code
+ * (.word etc) is skipped.
+ * @param path Listing file
+ * @return 0 if ok, -1 if it can't be read or has no instructions
+ */
+static int read_listing (const char *path)
+{
+	char line[512];
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned long addr;
+		char name[FN_NAME_MAX];
+		char *op;
+
+		if (sscanf(line, "%lx <%63[^>]>:", &addr, name) == 2) {
+			fns = grow(fns, numFns, &maxFns, sizeof(*fns));
+			memset(&fns[numFns], 0, sizeof(*fns));
+			strcpy(fns[numFns].name, name);
+			fns[numFns].addr = addr;
+			numFns++;
+			continue;
+		}
+		if (numFns == 0 || line[0] != ' ' || sscanf(line, " %lx:", &addr) != 1) {
+			continue;
+		}
+		// Mnemonic after the second tab
+		op = strchr(line, '\t');
+		op = op ? strchr(op + 1, '\t') : NULL;
+		if (op == NULL || op[1] == '.' || op[1] == '\n') {
+			continue;
+		}
+		op++;
+		instrs = grow(instrs, numInstrs, &maxInstrs, sizeof(*instrs));
+		instrs[numInstrs].addr = addr;
+		instrs[numInstrs].fn = numFns - 1;
+		instrs[numInstrs].ret = strncmp(op, "bx", 2) == 0
+				|| (strncmp(op, "pop", 3) == 0 && strstr(op, "pc") != NULL);
+		numInstrs++;
+	}
+	fclose(f);
+
+	if (numInstrs == 0) {
+		fprintf(stderr, "%s: no instructions, not objdump -d output?\n", path);
+		return -1;
+	}
+	qsort(instrs, numInstrs, sizeof(*instrs), instr_cmp);
+	return 0;
+}
+
+/**
+ * @brief Index of the first instruction at or above an address.
+ */
+static int instr_find (unsigned long addr)
+{
+	int lo = 0, hi = numInstrs;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (instrs[mid].addr < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static unsigned long get32 (const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/**
+ * @brief Count the instructions of one trace.
+ * @param p Packets
+ * @param n Number of packets
+ * @param bad Incremented for each run that doesn't fit the listing
+ * @return Number of runs counted
+ */
+static unsigned long decode_trace (const uint8_t *p, int n, unsigned long *bad)
+{
+	unsigned long runs = 0;
+	int k, i;
+
+	for (k = 0; k < n; k++) {
+		unsigned long dst = get32(&p[k * MTB_PACKET_LEN + 4]) & ~1UL;
+
+		i = instr_find(dst);
+		if (i < numInstrs && instrs[i].addr == dst && fns[instrs[i].fn].addr == dst) {
+			fns[instrs[i].fn].calls++;
+		}
+	}
+
+	for (k = 0; k + 1 < n; k++) {
+		unsigned long dst = get32(&p[k * MTB_PACKET_LEN + 4]) & ~1UL;
+		unsigned long src = get32(&p[(k+1) * MTB_PACKET_LEN]);
+		int start = get32(&p[(k+1) * MTB_PACKET_LEN + 4]) & 1;
+		int exception = src & 1;
+		int end;
+
+		// Tracing stopped somewhere after dst
+		if (start) {
+			continue;
+		}
+		src &= ~1UL;
+		i = instr_find(dst);
+		end = instr_find(src);
+		if (src < dst || src - dst > RUN_MAX || i == numInstrs
+				|| end == numInstrs || instrs[end].addr != src) {
+			(*bad)++;
+			continue;
+		}
+		// Exception entry: the source is the return address, not yet run
+		if ( ! exception || instrs[end].ret) {
+			end++;
+		}
+		for ( ; i < end; i++) {
+			fns[instrs[i].fn].count++;
+		}
+		runs++;
+	}
+	return runs;
+}
+
+int main (int argc, char *argv[])
+{
+	static uint8_t payload[PAYLOAD_MAX];
+	uint8_t hdr[FRAME_HEADER_LEN];
+	unsigned long frames = 0, traces = 0, skipped = 0, bad = 0, resync = 0;
+	unsigned long packets = 0, runs = 0, bad_runs = 0;
+	unsigned long long total = 0;
+	FILE *f = stdin;
+	int fill = 0, i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s listing.txt [capture.bin]\n", argv[0]);
+		return 1;
+	}
+	if (read_listing(argv[1]) != 0) {
+		return 1;
+	}
+	if (argc > 2 && (f = fopen(argv[2], "rb")) == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	while (1) {
+		FRAME_HEADER_T h;
+		uint16_t crc;
+		int c;
+
+		// Find sync: keep the last FRAME_HEADER_LEN bytes
+		while (fill < FRAME_HEADER_LEN && (c = getc(f)) != EOF) {
+			hdr[fill++] = c;
+		}
+		if (fill < FRAME_HEADER_LEN) {
+			break;
+		}
+		if (frame_header_read(hdr, &h) != 0 || h.version != FRAME_VERSION
+				|| h.payload_len > PAYLOAD_MAX) {
+			memmove(hdr, hdr + 1, --fill);
+			resync++;
+			continue;
+		}
+		if (fread(payload, 1, h.payload_len, f) != h.payload_len) {
+			break;
+		}
+		fill = 0;
+
+		crc = frame_crc16(0xFFFF, &hdr[FRAME_CRC_START], FRAME_CRC_END - FRAME_CRC_START);
+		crc = frame_crc16(crc, payload, h.payload_len);
+		if (crc != h.crc) {
+			bad++;
+			continue;
+		}
+		frames++;
+
+		if (h.type != FRAME_TYPE_TRACE || h.payload_len != h.sample_count * MTB_PACKET_LEN) {
+			skipped++;
+			continue;
+		}
+		traces++;
+		packets += h.sample_count;
+		runs += decode_trace(payload, h.sample_count, &bad_runs);
+	}
+
+	qsort(fns, numFns, sizeof(*fns), fn_cmp);
+	for (i = 0; i < numFns; i++) {
+		total += fns[i].count;
+	}
+	printf("# instructions pct calls function\n");
+	for (i = 0; i < numFns && fns[i].count > 0; i++) {
+		printf("%llu %.1f %lu %s\n", fns[i].count, 100.0 * fns[i].count / total,
+				fns[i].calls, fns[i].name);
+	}
+
+	fprintf(stderr, "%lu frames, %lu not traces, %lu bad crc, %lu bytes skipped\n",
+			frames, skipped, bad, resync);
+	fprintf(stderr, "%lu traces, %lu packets, %lu runs, %lu bad runs\n",
+			traces, packets, runs, bad_runs);
+	fprintf(stderr, "%llu instructions in %d functions\n", total, numFns);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#!/bin/sh
+# RAM cost of the functions placed in SRAM with RAM_FUNCS 1 (see inc/ramfunc.h),
+# from the linker map, and the RAM use of each output section in RamLoc8.
+#
+# Usage: ram_report.sh [map]   (default Debug/LPC824_ADC_DMA_example.map)
+
+MAP=${1:-Debug/LPC824_ADC_DMA_example.map}
+RAM_BASE=0x10000000
+RAM_SIZE=8192
+
+if [ ! -r "$MAP" ]; then
+	echo "$0: can't read $MAP (build first, the linker writes it)" >&2
+	exit 1
+fi
+
+awk -v ram_size=$RAM_SIZE -v ram_base=$RAM_BASE '
+function hex(s,    i, c, v) {
+	v = 0
+	s = tolower(s)
+	sub(/^0x/, "", s)
+	for (i = 1; i <= length(s); i++) {
+		c = index("0123456789abcdef", substr(s, i, 1)) - 1
+		if (c < 0) {
+			return -1
+		}
+		v = v * 16 + c
+	}
+	return v
+}
+function in_ram(a) {
+	return a >= hex(ram_base) && a < hex(ram_base) + ram_size
+}
+# Input section of a function in SRAM: " .ramfunc.$name addr size file", the
+# address and size on the next line if the name is long
+/^ \.ramfunc/ {
+	fn = $1
+	sub(/^\.ramfunc\.?\$?/, "", fn)
+	if (fn == "") {
+		fn = "(.ramfunc)"
+	}
+	if (NF >= 3) {
+		ramfunc[fn] += hex($3)
+		order[++nfn] = fn
+		fn = ""
+	}
+	next
+}
+fn != "" && $1 ~ /^0x/ && $2 ~ /^0x/ {
+	ramfunc[fn] += hex($2)
+	order[++nfn] = fn
+	fn = ""
+	next
+}
+# Output section: ".name addr size", the same way
+/^\.[A-Za-z_]/ {
+	sect = $1
+	if (NF >= 3 && $2 ~ /^0x/ && $3 ~ /^0x/) {
+		if (in_ram(hex($2))) {
+			size[sect] = hex($3)
+			sorder[++nsect] = sect
+		}
+		sect = ""
+	}
+	next
+}
+sect != "" && $1 ~ /^0x/ && $2 ~ /^0x/ {
+	if (in_ram(hex($1))) {
+		size[sect] = hex($2)
+		sorder[++nsect] = sect
+	}
+	sect = ""
+	next
+}
+{
+	fn = ""
+	sect = ""
+}
+END {
+	total = 0
+	if (nfn == 0) {
+		print "no functions in SRAM (built with RAM_FUNCS 0?)"
+	} else {
+		printf "%-28s %6s\n", "function in SRAM", "bytes"
+		for (i = 1; i <= nfn; i++) {
+			printf "%-28s %6d\n", order[i], ramfunc[order[i]]
+			total += ramfunc[order[i]]
+		}
+		printf "%-28s %6d\n", "total", total
+	}
+	used = 0
+	print ""
+	printf "%-28s %6s\n", "RamLoc8 section", "bytes"
+	for (i = 1; i <= nsect; i++) {
+		printf "%-28s %6d\n", sorder[i], size[sorder[i]]
+		used += size[sorder[i]]
+	}
+	printf "%-28s %6d of %d, %d free (stack and heap)\n", "used", used, ram_size, ram_size - used
+}
+' "$MAP"
@@ -0,0 +1,107 @@
+/*
+===============================================================================
+ Name        : block_queue.h
+ Description : Lock-free single-producer/single-consumer queue of completed DMA
+ blocks. The producer is DMA_IRQHandler (or the main loop itself, for a polled
+ DMA ring), the consumer is the main loop. Neither side masks interrupts: head
+ is only written by the producer and tail only by the consumer.
+
+ The queue also detects a consumer that is too slow. The DMA ring has
+ num_blocks blocks, so block seq is overwritten as soon as the DMA starts to
+ fill block seq + num_blocks, i.e. when produced >= seq + num_blocks. Such
+ blocks are counted in overruns instead of being silently processed.
+===============================================================================
+*/
+
+#ifndef BLOCK_QUEUE_H_
+#define BLOCK_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of queue entries. Must be a power of 2.
+#define BLOCKQ_SIZE 8
+
+typedef struct {
+	uint16_t index;			// Block index in the DMA ring (0 .. num_blocks-1)
+	uint16_t flags;			// Reserved
+	uint32_t seq;			// Block sequence number since capture start
+	uint32_t timestamp;		// Timestamp of block completion
+} BLOCKQ_ENTRY_T;
+
+typedef struct {
+	BLOCKQ_ENTRY_T entry[BLOCKQ_SIZE];
+	volatile uint32_t head;		// Next entry to write. Written by producer only.
+	volatile uint32_t tail;		// Next entry to read. Written by consumer only.
+	volatile uint32_t produced;	// Number of blocks completed by the DMA
+	volatile uint32_t dropped;	// Blocks not queued because the queue was full
+	uint32_t overruns;		// Blocks overwritten by the DMA before being released
+	uint16_t num_blocks;		// Number of blocks in the DMA ring
+	uint16_t next_index;		// Ring index of the next block to complete
+} BLOCKQ_T;
+
+/**
+ * @brief Reset queue and counters.
+ * @param q Queue
+ * @param num_blocks Number of blocks in the DMA descriptor ring
+ * @return None
+ */
+void blockq_init (BLOCKQ_T *q, uint16_t num_blocks);
+
+/**
+ * @brief Publish the block that the DMA has just completed. Call from the producer only.
+ * @param q Queue
+ * @param timestamp Time of block completion
+ * @return None
+ */
+void blockq_publish (BLOCKQ_T *q, uint32_t timestamp);
+
+/**
+ * @brief Get the oldest queued block without removing it. Blocks that have already
+ * been overwritten by the DMA are discarded and counted as overruns.
+ * @param q Queue
+ * @return Pointer to the entry, or NULL if no block is available.
+ */
+BLOCKQ_ENTRY_T *blockq_front (BLOCKQ_T *q);
+
+/**
+ * @brief Get the queued block i entries after the oldest, without removing it.
+ * Used when the oldest block is still in use (eg being transmitted) while the
+ * next one is processed. Unlike blockq_front() stale blocks are not discarded.
+ * @param q Queue
+ * @param i Position after the oldest entry (0 is the oldest)
+ * @return Pointer to the entry, or NULL if fewer than i+1 blocks are queued.
+ */
+BLOCKQ_ENTRY_T *blockq_peek (BLOCKQ_T *q, uint32_t i);
+
+/**
+ * @brief Test if the data of a queued block has not yet been overwritten by the DMA.
+ * @param q Queue
+ * @param e Entry returned by blockq_front()
+ * @return true if the block is intact
+ */
+static inline bool blockq_is_intact (const BLOCKQ_T *q, const BLOCKQ_ENTRY_T *e)
+{
+	return (q->produced - e->seq) < q->num_blocks;
+}
+
+/**
+ * @brief Remove the entry returned by blockq_front() once the consumer is done with
+ * the block, so that the ring slot can be reused.
+ * @param q Queue
+ * @return true if the block was intact for the whole time it was in use. If
+ * false the block was overwritten during processing and is counted as an overrun.
+ */
+bool blockq_release (BLOCKQ_T *q);
+
+/**
+ * @brief Number of blocks queued and not yet released.
+ * @param q Queue
+ * @return Number of entries
+ */
+static inline uint32_t blockq_pending (const BLOCKQ_T *q)
+{
+	return q->head - q->tail;
+}
+
+#endif /* BLOCK_QUEUE_H_ */
@@ -0,0 +1,50 @@
+/*
+===============================================================================
+ Name        : blockstats.h
+ Description : Single pass summary statistics of a block of ADC data register
+ values: min, max, sum, sum of squares and mid-scale crossings. The >>4 shift
+ is done as each value is read, so the block is read once.
+
+ Accumulators can't overflow for up to 3072 samples, the whole ADC buffer,
+ which the one-shot PROC_STATS output passes in one call: the sum is below
+ 3072 * 4095 < 2^24 and the sum of squares is 64 bit (3072 * 4095^2 < 2^36). Mean and RMS, exact, follow from sum and sumsq (see
+ bstats_ac_rms()). Estimated cost is about 16 cycles per sample on the
+ Cortex-M0+, ~1.6% of the core per 100ksps.
+===============================================================================
+*/
+
+#ifndef BLOCKSTATS_H_
+#define BLOCKSTATS_H_
+
+#include <stdint.h>
+
+// Mid-scale: crossings are counted for x >= BSTATS_MID vs x < BSTATS_MID
+#define BSTATS_MID 2048
+
+typedef struct {
+	uint16_t count;		// Number of samples
+	uint16_t min;
+	uint16_t max;
+	uint16_t crossings;	// Mid-scale crossings within the block
+	uint32_t sum;
+	uint64_t sumsq;
+} BSTATS_T;
+
+/**
+ * @brief Statistics of one channel of a block.
+ * @param s Statistics output
+ * @param dr ADC data register values (ADC value in bits 15:4), first sample of the channel
+ * @param n Number of samples of the channel, 1 - 3072
+ * @param stride Distance between samples of the channel (number of channels)
+ * @return None
+ */
+void bstats_block_dr (BSTATS_T *s, const uint16_t *dr, int n, int stride);
+
+/**
+ * @brief RMS about the mean (AC RMS), in ADC counts.
+ * @param s Statistics
+ * @return floor(sqrt(sumsq / count - (sum / count)^2))
+ */
+uint32_t bstats_ac_rms (const BSTATS_T *s);
+
+#endif /* BLOCKSTATS_H_ */
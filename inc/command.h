@@ -0,0 +1,83 @@
+/*
+===============================================================================
+ Name        : command.h
+ Description : Line based command parser on USART0 RX. A command is a line of
+ space separated words: a command name followed by its arguments, terminated
+ by '\n' or '\r'. Numbers are decimal, or hex with a 0x prefix.
+
+ Replies are a single line starting with "# ok" or "# err" followed by
+ "name value" fields, eg "# ok rate 500000". Lines starting with '#' are
+ ignored by GnuPlot, and in binary output formats a reply is only ever sent
+ between frames, so the host can skip it while looking for the next frame
+ sync word.
+
+ The binary baud rate request of uart_baud_handshake() ('B' followed by the
+ rate as 32 bit little-endian) is also accepted at the start of a line.
+===============================================================================
+*/
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Longest command line, excluding terminator. Longer lines are rejected.
+#define CMD_LINE_MAX 40
+
+// Maximum number of words in a command line, including the command name
+#define CMD_MAX_ARGS 4
+
+typedef struct {
+	const char *name;
+	// argv[0] is the command name. Handler must send the reply.
+	void (*handler) (int argc, char *argv[]);
+} CMD_T;
+
+/**
+ * @brief Read received bytes and run any complete command lines. Call from the
+ * main loop.
+ * @param table Commands
+ * @param n Number of commands in table
+ * @return true if any bytes were received
+ */
+bool cmd_poll (const CMD_T *table, int n);
+
+/**
+ * @brief Parse an unsigned number argument.
+ * @param s Argument
+ * @param v Value
+ * @return false if s is not a number or is above UINT32_MAX
+ */
+bool cmd_parse_uint (const char *s, uint32_t *v);
+
+/**
+ * @brief Start a reply line. Waits for any frame being sent by DMA to finish so
+ * that the reply doesn't land in the middle of it.
+ * @param ok Send "# ok" if true, "# err" if false
+ * @return None
+ */
+void cmd_reply_begin (bool ok);
+
+/**
+ * @brief Add a " name value" field to a reply line.
+ * @param name Field name
+ * @param value Field value
+ * @return None
+ */
+void cmd_reply_field (const char *name, int value);
+
+/**
+ * @brief Add a " text" word to a reply line.
+ * @param s Text
+ * @return None
+ */
+void cmd_reply_word (const char *s);
+
+/**
+ * @brief End a reply line.
+ * @return None
+ */
+void cmd_reply_end (void);
+
+#endif /* COMMAND_H_ */
@@ -0,0 +1,46 @@
+/*
+===============================================================================
+ Name        : fft.h
+ Description : In place fixed point FFT of a block of real ADC samples, giving
+ the power spectrum.
+
+ The n real samples are treated as n/2 complex values (even samples real, odd
+ imaginary), transformed by a radix-2 complex FFT scaled by 1/2 every stage,
+ and split into the n/2 + 1 bins of the real FFT. This needs no memory beyond
+ the block itself, which is overwritten with the n/2 power bins as 32 bit
+ values. Twiddle factors come from a quarter wave sine table in flash.
+
+ Samples are converted to Q15 (ADC full scale +/-16384) and Hann windowed.
+ Bin k is frequency k * sample_rate / n; bin 0 is DC (Nyquist is dropped). The
+ output is |X(k) / n|^2: a tone of amplitude A (ADC counts) at a bin centre
+ gives about 4 * A^2, eg 16.76e6 for full scale.
+===============================================================================
+*/
+
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <stdint.h>
+
+#define FFT_MIN_N 16
+#define FFT_MAX_N 1024
+
+/**
+ * @brief Power spectrum of a block of ADC data register values, in place.
+ * @param buf ADC data register values (ADC value in bits 15:4). Overwritten with
+ * n/2 power bins, each a 32 bit value stored as 2 uint16: low half first.
+ * @param n Number of values, a power of 2 from FFT_MIN_N to FFT_MAX_N
+ * @return None
+ */
+void fft_power_dr (uint16_t *buf, int n);
+
+/**
+ * @brief In place forward complex FFT, scaled by 1/m.
+ * @param z m complex values, real and imaginary parts interleaved. Magnitudes
+ * must be below 23170 (32767 / sqrt(2)) so that butterflies can't overflow.
+ * @param m Number of complex values, a power of 2 up to FFT_MAX_N / 2
+ * @return None
+ */
+void fft_complex (int16_t *z, int m);
+
+#endif /* FFT_H_ */
@@ -0,0 +1,209 @@
+/*
+===============================================================================
+ Name        : frame.h
+ Description : Binary frame format used to send sample blocks to the host.
+ This file has no hardware dependencies so that it can also be used by host
+ side tools.
+
+ A frame is a FRAME_HEADER_LEN byte header followed by payload_len bytes of
+ payload. All multi-byte fields are little-endian.
+
+   offset size field
+   0      2    sync         FRAME_SYNC (bytes 0x5A 0xA5)
+   2      1    version      FRAME_VERSION
+   3      1    type         FRAME_TYPE_*
+   4      4    seq          Block sequence number
+   8      4    sample_rate  Sample rate in Hz
+   12     2    sample_count Number of samples in the payload
+   14     2    payload_len  Payload length in bytes
+   16     2    chan_mask    ADC channels in the payload, bit n for ADCn
+   18     2    ratio        Compression ratio of the payload vs 12 bit packed
+                            samples, Q8 (256 is 1.0), 0 if not samples
+   20     2    adc_overruns ADC overrun interrupts since capture start, mod 2^16
+                            (single channel capture only, 0 otherwise)
+   22     2    lost_blocks  DMA blocks lost since capture start, mod 2^16:
+                            overwritten by the DMA before being output,
+                            not queued (see block_queue.h), or shed by
+                            back-pressure or refused by the link
+   24     2    crc          CRC-16/CCITT-FALSE (poly 0x1021, seed 0xFFFF) of
+                            header bytes 2..23 followed by the payload
+
+ sample_rate is the rate per channel and sample_count counts all channels.
+ If chan_mask has more than one channel the samples are interleaved in
+ ascending channel order (eg ADC3, ADC9, ADC3, ADC9, ...) and sample_count is
+ a multiple of the number of channels.
+
+ FRAME_TYPE_PACKED12 payload: 12 bit samples packed 2 samples in 3 bytes.
+ Sample a, b become bytes a[7:0], b[3:0]<<4 | a[11:8], b[11:4]. If
+ sample_count is odd the last sample is sent as a[7:0], a[11:8].
+
+ FRAME_TYPE_RAW16 payload: 16 bit ADC data register values, 2 bytes per
+ sample. Sample value is in bits 15:4 (ie value >> 4).
+
+ FRAME_TYPE_RICE payload: 12 bit samples delta + Rice coded (see rice.h), each
+ channel predicted from its own previous sample.
+
+ FRAME_TYPE_Q15 payload: signed 16 bit samples, 2 bytes per sample. Used for
+ filtered output (see decimate.h).
+
+ FRAME_TYPE_TONES payload: per tone bin a 32 bit frequency in Hz then a 32 bit
+ magnitude (see goertzel.h), 8 bytes per bin. sample_count is the number of
+ samples measured: a tone of amplitude A has magnitude about sample_count * A / 2.
+
+ FRAME_TYPE_SPECTRUM payload: sample_count / 2 power bins (see fft.h), 32 bits
+ each. Bin k is frequency k * sample_rate / sample_count.
+
+ FRAME_TYPE_STATS payload: per channel, in ascending channel order, 20 bytes
+ of block statistics (see blockstats.h) of sample_count / channels samples:
+   0  min (16)   2  max (16)   4  crossings (16)   6  flags (16)
+   8  sum (32)  12  sum of squares (64)
+ flags bit 0 is set if the channel is outside the alarm limits.
+
+ FRAME_TYPE_TRACE payload: sample_count MTB trace packets of 8 bytes (see
+ mtb_trace.h), in the order written. seq counts the traces sent.
+===============================================================================
+*/
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stdint.h>
+
+#define FRAME_SYNC 0xA55A
+#define FRAME_VERSION 4
+#define FRAME_HEADER_LEN 26
+
+// Header bytes covered by the CRC (after sync, before crc)
+#define FRAME_CRC_START 2
+#define FRAME_CRC_END 24
+
+#define FRAME_TYPE_PACKED12 1
+#define FRAME_TYPE_RAW16 2
+#define FRAME_TYPE_Q15 3
+#define FRAME_TYPE_TONES 4
+#define FRAME_TYPE_SPECTRUM 5
+#define FRAME_TYPE_STATS 6
+#define FRAME_TYPE_RICE 7
+#define FRAME_TYPE_TRACE 8
+
+#define FRAME_STATS_LEN 20
+#define FRAME_STATS_ALARM 0x0001
+
+typedef struct {
+	uint8_t version;
+	uint8_t type;
+	uint32_t seq;
+	uint32_t sample_rate;
+	uint16_t sample_count;
+	uint16_t payload_len;
+	uint16_t chan_mask;
+	uint16_t ratio;
+	uint16_t adc_overruns;
+	uint16_t lost_blocks;
+	uint16_t crc;
+} FRAME_HEADER_T;
+
+/**
+ * @brief Serialize frame header.
+ * @param h Header
+ * @param buf Output, FRAME_HEADER_LEN bytes
+ * @return None
+ */
+void frame_header_write (const FRAME_HEADER_T *h, uint8_t *buf);
+
+/**
+ * @brief Parse frame header.
+ * @param buf Input, FRAME_HEADER_LEN bytes
+ * @param h Header
+ * @return 0 on success, -1 if buf does not start with FRAME_SYNC
+ */
+int frame_header_read (const uint8_t *buf, FRAME_HEADER_T *h);
+
+/**
+ * @brief Number of channels in a chan_mask.
+ */
+static inline int frame_channel_count (uint16_t chan_mask)
+{
+	int n = 0;
+	for ( ; chan_mask; chan_mask &= chan_mask - 1) {
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @brief Write a 16 bit value little-endian.
+ */
+static inline void frame_put16 (uint8_t *buf, uint16_t v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+}
+
+/**
+ * @brief Write a 32 bit value little-endian.
+ */
+static inline void frame_put32 (uint8_t *buf, uint32_t v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+	buf[2] = v >> 16;
+	buf[3] = v >> 24;
+}
+
+/**
+ * @brief Number of payload bytes needed for n packed 12 bit samples.
+ */
+static inline int frame_packed12_len (int n)
+{
+	return n + (n+1)/2;
+}
+
+/**
+ * @brief Header ratio field for a payload.
+ * @param type FRAME_TYPE_*
+ * @param sample_count Number of samples
+ * @param payload_len Payload length in bytes
+ * @return Q8 ratio of packed 12 bit size to payload_len, 0 if the payload isn't samples
+ */
+static inline uint16_t frame_ratio (uint8_t type, uint16_t sample_count, uint16_t payload_len)
+{
+	uint32_t r;
+
+	if ((type != FRAME_TYPE_PACKED12 && type != FRAME_TYPE_RAW16
+			&& type != FRAME_TYPE_Q15 && type != FRAME_TYPE_RICE) || payload_len == 0) {
+		return 0;
+	}
+	r = ((uint32_t)frame_packed12_len(sample_count) << 8) / payload_len;
+	return r > 0xffff ? 0xffff : r;
+}
+
+/**
+ * @brief Pack 12 bit samples 2 samples in 3 bytes. out may be the same memory as in.
+ * @param in Samples in range 0 - 4095
+ * @param n Number of samples
+ * @param out Packed output, frame_packed12_len(n) bytes
+ * @return Number of bytes written
+ */
+int frame_pack12 (const uint16_t *in, int n, uint8_t *out);
+
+/**
+ * @brief Unpack 12 bit samples packed with frame_pack12().
+ * @param in Packed samples
+ * @param n Number of samples
+ * @param out Samples
+ * @return None
+ */
+void frame_unpack12 (const uint8_t *in, int n, uint16_t *out);
+
+/**
+ * @brief Update CRC-16/CCITT-FALSE in software. This gives the same result as the
+ * LPC82x CRC engine in CCITT mode.
+ * @param crc CRC so far (0xFFFF to start)
+ * @param buf Data
+ * @param n Number of bytes
+ * @return Updated CRC
+ */
+uint16_t frame_crc16 (uint16_t crc, const uint8_t *buf, int n);
+
+#endif /* FRAME_H_ */
@@ -0,0 +1,70 @@
+/*
+===============================================================================
+ Name        : goertzel.h
+ Description : Goertzel tone detector bank, integer arithmetic only. Each bin
+ measures the magnitude of the DTFT of a block at one frequency, which need
+ not be a multiple of sample_rate / n.
+
+ Coefficients 2cos(2 pi f / fs) are Q14. For a block of n samples of a tone of
+ amplitude A (ADC counts) at a bin frequency the magnitude is about n * A / 2.
+
+ The recurrence s = x + coeff * s1 - s2 lets s grow to about
+ n * 2048 / sin(2 pi f / fs), more than the 17 bits that leave room for a Q14
+ multiply in 32 bits. The Cortex-M0+ only has a 32 x 32 -> 32 bit multiply, so
+ coeff * s1 is done as two 16 bit halves of s1 (see goertzel.c). Estimated
+ cost is about 20 cycles per sample per bin: at 500ksps the 30MHz core can
+ afford about 2 bins continuously. Blocks that can't be processed in time are
+ skipped (counted as overruns); a lower sample rate (eg 200ksps for 40kHz) or
+ fewer bins allows continuous monitoring.
+===============================================================================
+*/
+
+#ifndef GOERTZEL_H_
+#define GOERTZEL_H_
+
+#include <stdint.h>
+
+#define GOERTZEL_MAX_BINS 8
+
+typedef struct {
+	int nbins;
+	uint32_t freq[GOERTZEL_MAX_BINS];	// Bin frequency in Hz
+	int32_t coeff[GOERTZEL_MAX_BINS];	// 2cos(2 pi f / fs), Q14
+} GOERTZEL_T;
+
+/**
+ * @brief Setup a bank of bins.
+ * @param g Goertzel bank
+ * @param freq Bin frequencies in Hz, each less than sample_rate / 2
+ * @param nbins Number of bins, max GOERTZEL_MAX_BINS
+ * @param sample_rate Sample rate in Hz
+ * @return None
+ */
+void goertzel_init (GOERTZEL_T *g, const uint32_t *freq, int nbins, uint32_t sample_rate);
+
+/**
+ * @brief Compute the magnitude of each bin over a block of ADC data register
+ * values. The mid-scale offset 2048 is removed first.
+ * @param g Goertzel bank
+ * @param dr ADC data register values (ADC value in bits 15:4)
+ * @param n Number of values, max 4096
+ * @param mag Magnitude of each bin
+ * @return None
+ */
+void goertzel_block_dr (const GOERTZEL_T *g, const uint16_t *dr, int n, uint32_t *mag);
+
+/**
+ * @brief cos(2 pi turn / 2^32) in Q14, using integer arithmetic only.
+ * @param turn Angle as a fraction of a full turn, Q32
+ * @return Cosine, Q14
+ */
+int32_t goertzel_cos_q14 (uint32_t turn);
+
+/**
+ * @brief Integer square root.
+ * @param v Value
+ * @return floor(sqrt(v))
+ */
+uint32_t goertzel_isqrt64 (uint64_t v);
+
+#endif /* GOERTZEL_H_ */
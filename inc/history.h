@@ -0,0 +1,87 @@
+/*
+===============================================================================
+ Name        : history.h
+ Description : Sample history ring holding 12 bit samples packed 2 samples in
+ 3 bytes, in the same layout as a FRAME_TYPE_PACKED12 payload (see frame.h).
+ Storing finished DMA blocks packed instead of as 16 bit ADC data register
+ values keeps 4/3 as many samples in the same memory.
+
+ Samples are numbered from 0 since hist_init(). Sample s is still held in the
+ ring while count - s <= size. Samples are written in pairs so that a pair never
+ straddles the end of the ring.
+===============================================================================
+*/
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+
+typedef struct {
+	uint8_t *buf;		// Packed samples
+	uint32_t size;		// Capacity in samples (even)
+	uint32_t count;		// Number of samples written since hist_init()
+	uint32_t wr;		// Byte offset in buf of sample count
+} HIST_T;
+
+/**
+ * @brief Number of samples a ring of len bytes can hold.
+ * @param len Ring size in bytes
+ * @return Capacity in samples
+ */
+static inline uint32_t hist_capacity (uint32_t len)
+{
+	return (len / 3) * 2;
+}
+
+/**
+ * @brief Initialize an empty history ring.
+ * @param h History ring
+ * @param buf Storage
+ * @param len Size of buf in bytes
+ * @return None
+ */
+void hist_init (HIST_T *h, uint8_t *buf, uint32_t len);
+
+/**
+ * @brief Append ADC data register values to the ring: each value is shifted 4 bits
+ * right and packed. Overwrites the oldest samples once the ring is full.
+ * @param h History ring
+ * @param dr ADC data register values
+ * @param n Number of values. Must be even.
+ * @param stride Distance between values in dr. With interleaved samples of
+ * several channels, this de-interleaves one channel.
+ * @return None
+ */
+void hist_write_dr (HIST_T *h, const uint16_t *dr, uint32_t n, uint32_t stride);
+
+/**
+ * @brief Number of the oldest sample still held in the ring.
+ * @param h History ring
+ * @return Sample number
+ */
+static inline uint32_t hist_oldest (const HIST_T *h)
+{
+	return h->count > h->size ? h->count - h->size : 0;
+}
+
+/**
+ * @brief Read one sample.
+ * @param h History ring
+ * @param s Sample number, hist_oldest() <= s < count
+ * @return 12 bit sample value
+ */
+uint16_t hist_get (const HIST_T *h, uint32_t s);
+
+/**
+ * @brief Locate the packed bytes of a run of samples starting at an even sample
+ * number, for sending as a FRAME_TYPE_PACKED12 payload without unpacking.
+ * @param h History ring
+ * @param s Even sample number, hist_oldest() <= s < count
+ * @param n In: number of samples wanted. Out: number of samples that are
+ * contiguous in the ring (smaller than requested if the run wraps).
+ * @return Packed bytes of sample s
+ */
+const uint8_t *hist_span (const HIST_T *h, uint32_t s, uint32_t *n);
+
+#endif /* HISTORY_H_ */
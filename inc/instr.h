@@ -0,0 +1,143 @@
+/*
+===============================================================================
+ Name        : instr.h
+ Description : Hot path instrumentation. Each stage keeps the number of
+ events and the min, max and total duration in system clock cycles, from the
+ free running SysTick (see systick.h), so the stats can be dumped on command
+ without an oscilloscope.
+
+ Stages are timed with INSTR_BEGIN() / INSTR_END(), or a duration measured
+ elsewhere is added with INSTR_RECORD(). INSTR_END() costs about 30 cycles.
+
+ The core sleeps only through INSTR_SLEEP() (a __WFE()), which splits time
+ into the awake and asleep stages. These are timed by MRT channel
+ INSTR_MRT_CH rather than SysTick, which is clocked by the core and may not
+ count while it sleeps. Interrupt handlers are timed with INSTR_ISR_BEGIN() /
+ INSTR_ISR_END(). A handler that preempts the main loop while it is awake is
+ already in awake; one that runs in INSTR_SLEEP() is in asleep, though the
+ core was running. So the active duty cycle is awake plus only the handler
+ time inside INSTR_SLEEP() (outermost handler, if they nest) over awake plus
+ asleep.
+
+ It is off by default: with INSTR_ENABLE 0 the macros expand to nothing and
+ instr.c is empty, so a plain build isn't slowed by it. Build with INSTR_ENABLE
+ 1 (eg -DINSTR_ENABLE=1, as "make bench" and "make debug") for the "instr"
+ command.
+===============================================================================
+*/
+
+#ifndef INSTR_H_
+#define INSTR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef INSTR_ENABLE
+#define INSTR_ENABLE 0
+#endif
+
+// Stages
+#define INSTR_DMA_ISR 0		// DMA_IRQHandler entry to exit
+#define INSTR_THCMP_ISR 1	// ADC_THCMP_IRQHandler entry to exit
+#define INSTR_UART_ISR 2	// UART0_IRQHandler entry to exit
+#define INSTR_HANDOFF 3		// DMA block complete to main loop picking it up
+#define INSTR_PROC 4		// Processing (packing, coding, filters) of a block
+#define INSTR_TX 5			// Frame DMA transmit start to complete
+#define INSTR_AWAKE 6		// Wake up to the next INSTR_SLEEP()
+#define INSTR_ASLEEP 7		// In INSTR_SLEEP(), including interrupt handlers
+#define INSTR_NUM_STAGES 8
+
+// MRT channel used as the sleep-proof 31 bit cycle counter
+#define INSTR_MRT_CH 3
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t start;		// INSTR_BEGIN() time
+} INSTR_STAGE_T;
+
+#if INSTR_ENABLE
+
+#include "systick.h"
+
+extern INSTR_STAGE_T instrStage[INSTR_NUM_STAGES];
+
+// Interrupt handlers timed by INSTR_ISR_BEGIN() running, nested
+extern volatile uint8_t instrIsrDepth;
+
+/**
+ * @brief Start the MRT time base for the awake and asleep stages.
+ * @return None
+ */
+void instr_init (void);
+
+/**
+ * @brief Sleep until an event or interrupt (__WFE()), recording the time awake
+ * since the last wake up and the time asleep.
+ * @return None
+ */
+void instr_sleep (void);
+
+/**
+ * @brief Active duty cycle since the last instr_reset(): awake plus the
+ * interrupt handler time inside instr_sleep() over awake plus asleep time.
+ * @return Duty cycle in 1/1000, 0 if nothing has been recorded
+ */
+uint32_t instr_duty_permille (void);
+
+/**
+ * @brief Add one event to a stage.
+ * @param stage INSTR_*
+ * @param cycles Duration in system clock cycles
+ * @return None
+ */
+void instr_record (int stage, uint32_t cycles);
+
+/**
+ * @brief Add one run of an interrupt handler to its stage, at the end of the
+ * handler (INSTR_ISR_END()). The outermost handler's time is also counted as
+ * active if it ran inside instr_sleep().
+ * @param stage INSTR_*_ISR
+ * @param cycles Duration in system clock cycles
+ * @return None
+ */
+void instr_record_isr (int stage, uint32_t cycles);
+
+/**
+ * @brief Clear all stages.
+ * @return None
+ */
+void instr_reset (void);
+
+/**
+ * @brief Stage name, for the dump.
+ * @param stage INSTR_*
+ * @return Name
+ */
+const char *instr_name (int stage);
+
+#define INSTR_BEGIN(stage) (instrStage[stage].start = systick_now())
+#define INSTR_END(stage) \
+	instr_record(stage, systick_elapsed(instrStage[stage].start, systick_now()))
+#define INSTR_RECORD(stage, cycles) instr_record(stage, cycles)
+#define INSTR_ISR_BEGIN(stage) (instrIsrDepth++, INSTR_BEGIN(stage))
+#define INSTR_ISR_END(stage) \
+	instr_record_isr(stage, systick_elapsed(instrStage[stage].start, systick_now()))
+#define INSTR_INIT() instr_init()
+#define INSTR_SLEEP() instr_sleep()
+
+#else
+
+#define INSTR_BEGIN(stage)
+#define INSTR_END(stage)
+#define INSTR_RECORD(stage, cycles)
+#define INSTR_ISR_BEGIN(stage)
+#define INSTR_ISR_END(stage)
+#define INSTR_INIT()
+#define INSTR_SLEEP() __WFE()
+
+#endif /* INSTR_ENABLE */
+
+#endif /* INSTR_H_ */
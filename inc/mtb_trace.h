@@ -0,0 +1,119 @@
+/*
+===============================================================================
+ Name        : mtb_trace.h
+ Description : Profiling of the hot path on the board, without a debug probe,
+ by the Cortex-M0+ Micro Trace Buffer. While enabled the MTB writes a packet to
+ __mtb_buffer__ (src/mtb.c, __MTB_BUFFER_SIZE bytes of SRAM) for every non
+ sequential change of PC: branches taken, exception entry and return. The
+ instructions in between ran in sequence, so with the disassembly the host
+ counts the instructions executed per function (host/mtb_decode.c).
+
+ Packet, 2 little-endian words (ARM DDI 0486, MTB-M0+ TRM):
+   word 0  source address, bit 0 set for exception entry or return
+   word 1  destination address, bit 0 set for the first packet after the
+           trace was started
+
+ Tracing is only on between MTB_TRACE_BEGIN() and MTB_TRACE_END(), which wrap
+ DMA_IRQHandler and the block processing stages. They nest, as the handler can
+ interrupt processing. mtb_trace_arm() starts a new trace at the start of the
+ buffer, and the FLOW watermark stops it when the buffer is full rather than
+ wrapping, so a trace is the first packets after arming. The "mtb" command
+ sends it as a FRAME_TYPE_TRACE frame and arms again.
+
+ Build with MTB_TRACE 1 (eg -DMTB_TRACE=1) for a profiling build. A bigger
+ buffer (eg -D__MTB_BUFFER_SIZE=512) gives longer traces but comes out of the
+ stack. With MTB_TRACE 0 (the default) the macros expand to nothing and
+ mtb_trace.c is empty. Don't use trace in the debugger at the same time.
+===============================================================================
+*/
+
+#ifndef MTB_TRACE_H_
+#define MTB_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef MTB_TRACE
+#define MTB_TRACE 0
+#endif
+
+// Bytes per trace packet
+#define MTB_PACKET_LEN 8
+
+#if MTB_TRACE
+
+// MTB registers (UM10800 memory map, ARM DDI 0486 for the fields)
+#define MTB_REG_BASE 0x14000000
+#define MTB_POSITION (*(volatile uint32_t *)(MTB_REG_BASE + 0x000))
+#define MTB_MASTER (*(volatile uint32_t *)(MTB_REG_BASE + 0x004))
+#define MTB_FLOW (*(volatile uint32_t *)(MTB_REG_BASE + 0x008))
+#define MTB_BASE (*(volatile uint32_t *)(MTB_REG_BASE + 0x00C))
+
+#define MTB_MASTER_EN (1UL << 31)
+#define MTB_FLOW_AUTOSTOP (1 << 0)
+#define MTB_POINTER_MASK 0xFFFFFFF8
+
+// MTB_TRACE_BEGIN() nesting depth
+extern volatile uint8_t mtbDepth;
+
+// MASTER value to trace: EN and the buffer size, 0 if not armed
+extern volatile uint32_t mtbMaster;
+
+/**
+ * @brief Stop the MTB and arm the first trace.
+ * @return None
+ */
+void mtb_trace_init (void);
+
+/**
+ * @brief Start a new trace at the start of the buffer, from the next
+ * MTB_TRACE_BEGIN().
+ * @return None
+ */
+void mtb_trace_arm (void);
+
+/**
+ * @brief Stop tracing and get the trace since mtb_trace_arm().
+ * @param buf Set to the packets, in the order written. Valid until mtb_trace_arm().
+ * @param full Set to true if tracing stopped because the buffer is full
+ * @return Number of packets
+ */
+int mtb_trace_get (const uint8_t **buf, bool *full);
+
+/**
+ * @brief Start tracing, unless already inside a traced stage.
+ */
+static inline void mtb_trace_begin (void)
+{
+	if (mtbDepth++ == 0) {
+		MTB_MASTER = mtbMaster;
+	}
+}
+
+/**
+ * @brief Stop tracing at the end of the outermost traced stage. Once the
+ * watermark has stopped the MTB it stays disarmed until mtb_trace_arm().
+ */
+static inline void mtb_trace_end (void)
+{
+	if (--mtbDepth == 0) {
+		MTB_MASTER = mtbMaster & ~MTB_MASTER_EN;
+		if ((MTB_POSITION & MTB_POINTER_MASK) >= (MTB_FLOW & MTB_POINTER_MASK)) {
+			mtbMaster = 0;
+		}
+	}
+}
+
+#define MTB_TRACE_BEGIN() mtb_trace_begin()
+#define MTB_TRACE_END() mtb_trace_end()
+#define MTB_TRACE_INIT() mtb_trace_init()
+
+#else
+
+#define MTB_TRACE_BEGIN()
+#define MTB_TRACE_END()
+#define MTB_TRACE_INIT()
+
+#endif /* MTB_TRACE */
+
+#endif /* MTB_TRACE_H_ */
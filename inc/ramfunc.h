@@ -0,0 +1,35 @@
+/*
+===============================================================================
+ Name        : ramfunc.h
+ Description : Optional SRAM placement of the hot path. Flash needs a wait
+ state at 30MHz, so tight loops run faster from SRAM, at the cost of SRAM: the
+ code is in .data, copied from flash by the startup code.
+
+ Build with RAM_FUNCS 1 (eg -DRAM_FUNCS=1) to place every function marked
+ HOT_FUNC(name) in its own ".ramfunc.$name" section, which the linker script
+ puts in RamLoc8 (see cr_section_macros.h). Marked are DMA_IRQHandler, the
+ block hand-off and the processing kernels. host/ram_report.sh lists what they
+ cost from the linker map. With RAM_FUNCS 0 (the default) HOT_FUNC() expands
+ to nothing.
+
+ Calls from SRAM to flash (libgcc helpers, the ROM divide) go through a long
+ branch veneer added by the linker, a few cycles each.
+===============================================================================
+*/
+
+#ifndef RAMFUNC_H_
+#define RAMFUNC_H_
+
+#include <cr_section_macros.h>
+
+#ifndef RAM_FUNCS
+#define RAM_FUNCS 0
+#endif
+
+#if RAM_FUNCS
+#define HOT_FUNC(name) __RAM_FUNC_EXT(name)
+#else
+#define HOT_FUNC(name)
+#endif
+
+#endif /* RAMFUNC_H_ */
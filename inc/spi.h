@@ -0,0 +1,68 @@
+/*
+===============================================================================
+ Name        : spi.h
+ Description : SPI0 master transmit of frames by DMA, an alternative to USART0
+ for rates the UART can't carry: raw 500ksps x 12 bit is 6Mbit/s, SPI0 runs
+ at up to half the system clock.
+
+ The DMA transmit engine uses DMA channel 7, which is hard wired to the SPI0
+ TX DMA request (UM10800 §12.5.1, Table 159). Each frame is one SPI transfer:
+ SSEL0 is asserted for the whole frame and deasserted after its last byte, so
+ the receiver (an SPI slave) can find frame boundaries without the sync word.
+ Mode 0 (CPOL 0, CPHA 0), MSB first, 8 bit frames. MISO is not used.
+===============================================================================
+*/
+
+#ifndef SPI_H_
+#define SPI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// DMA channel for SPI0 TX
+#define SPI_DMA_CH DMA_CH7
+
+// Maximum payload for one spi_dma_send(). Each descriptor moves up to 1024 bytes.
+#define SPI_DMA_MAX_PAYLOAD_DESC 5
+#define SPI_DMA_MAX_PAYLOAD (SPI_DMA_MAX_PAYLOAD_DESC * 1024)
+
+/**
+ * @brief Initialize SPI0 as master with SCK at or below the given bit rate, and
+ * DMA channel SPI_DMA_CH for SPI0 TX. Pins must already be assigned with the
+ * switch matrix. The DMA controller must already be initialized and enabled.
+ * @param bitrate SCK frequency in Hz, max half the system clock
+ * @return None
+ */
+void spi_init (uint32_t bitrate);
+
+/**
+ * @brief Get the actual SCK frequency.
+ * @return Bit rate in Hz
+ */
+uint32_t spi_get_bitrate (void);
+
+/**
+ * @brief Start sending a frame by DMA. Both buffers must remain unchanged until
+ * spi_dma_busy() returns false.
+ * @param hdr Header bytes (max 1024)
+ * @param hdr_len Number of header bytes
+ * @param payload Payload bytes
+ * @param len Number of payload bytes (max SPI_DMA_MAX_PAYLOAD). May be 0.
+ * @return false if a previous transfer is still in progress, or the header or
+ * payload is too long (nothing is sent).
+ */
+bool spi_dma_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len);
+
+/**
+ * @brief Test if a DMA transfer started with spi_dma_send() is in progress.
+ * @return true if busy
+ */
+bool spi_dma_busy (void);
+
+/**
+ * @brief Handle DMA interrupt A for SPI_DMA_CH. Call from DMA_IRQHandler.
+ * @return None
+ */
+void spi_dma_irq (void);
+
+#endif /* SPI_H_ */
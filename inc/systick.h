@@ -0,0 +1,46 @@
+/*
+===============================================================================
+ Name        : systick.h
+ Description : Free running SysTick used as a 24 bit system clock cycle
+ counter. No SysTick interrupt is used (SysTick_Handler traps in
+ cr_startup_lpc82x.c), so the count simply wraps every 2^24 cycles (about
+ 0.56s at 30MHz).
+===============================================================================
+*/
+
+#ifndef SYSTICK_H_
+#define SYSTICK_H_
+
+#define SYSTICK_MASK 0xFFFFFF
+
+/**
+ * @brief Start SysTick free running from the system clock, no interrupt.
+ * @return None
+ */
+static inline void systick_init (void)
+{
+	SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+/**
+ * @brief Read SysTick. SysTick counts down, so the count is inverted to give a
+ * 24 bit up-counter of system clock cycles.
+ * @return Cycle count modulo 2^24
+ */
+static inline uint32_t systick_now (void)
+{
+	return SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
+}
+
+/**
+ * @brief Cycles from start to end, both from systick_now(). Valid for intervals
+ * shorter than 2^24 cycles.
+ */
+static inline uint32_t systick_elapsed (uint32_t start, uint32_t end)
+{
+	return (end - start) & SYSTICK_MASK;
+}
+
+#endif /* SYSTICK_H_ */
@@ -0,0 +1,94 @@
+/*
+===============================================================================
+ Name        : transport.h
+ Description : Link that binary frames are sent on. Capture and processing
+ code calls transport_send() and transport_busy() and doesn't care which
+ backend is selected: USART0 polled (print_byte()), USART0 by DMA (uart.h) or
+ SPI0 by DMA (spi.h). Text output and command replies always use USART0.
+
+ Back-pressure: each backend reports its free space and throughput, from
+ which transport_drain_cycles() and transport_tx_cycles() tell the capture
+ pipeline how long the link will take, so that it can reduce or drop a block
+ that it couldn't send before the DMA overwrites it.
+===============================================================================
+*/
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Backends
+#define TRANSPORT_UART 0		// USART0, sent by the CPU
+#define TRANSPORT_UART_DMA 1	// USART0, sent by DMA
+#define TRANSPORT_SPI 2			// SPI0 master, sent by DMA
+#define TRANSPORT_NUM 3
+
+typedef struct {
+	const char *name;
+	// Start sending a frame, header then payload. false if the previous frame is
+	// still being sent. The buffers must not change until busy() is false.
+	bool (*send) (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len);
+	// true while a frame is being sent
+	bool (*busy) (void);
+	// Largest payload send() accepts now, 0 while busy
+	uint32_t (*space) (void);
+	// Throughput in bytes per second
+	uint32_t (*rate) (void);
+} TRANSPORT_T;
+
+/**
+ * @brief Select the backend frames are sent on. Waits for any frame being sent on
+ * the previous one.
+ * @param id TRANSPORT_*
+ * @return false if id is not a backend
+ */
+bool transport_select (int id);
+
+/**
+ * @brief Selected backend.
+ * @return TRANSPORT_*
+ */
+int transport_get (void);
+
+/**
+ * @brief Backend name, for commands and stats.
+ * @param id TRANSPORT_*
+ * @return Name, or NULL if id is not a backend
+ */
+const char *transport_name (int id);
+
+/**
+ * @brief Start sending a frame on the selected backend, see TRANSPORT_T.send.
+ * @return false if the previous frame is still being sent
+ */
+bool transport_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len);
+
+/**
+ * @brief Test if a frame is being sent on the selected backend.
+ * @return true if busy
+ */
+bool transport_busy (void);
+
+/**
+ * @brief Largest payload the selected backend accepts now, see TRANSPORT_T.space.
+ * @return Bytes, 0 while busy
+ */
+uint32_t transport_space (void);
+
+/**
+ * @brief Time the selected backend takes to send some bytes.
+ * @param bytes Number of bytes, header included
+ * @return System clock cycles
+ */
+uint32_t transport_tx_cycles (uint32_t bytes);
+
+/**
+ * @brief Expected time until the frame being sent is done, from its size and the
+ * link throughput. Valid for frames that take less than 2^24 cycles to send.
+ * @return System clock cycles, 0 if idle
+ */
+uint32_t transport_drain_cycles (void);
+
+#endif /* TRANSPORT_H_ */
@@ -0,0 +1,191 @@
+/*
+===============================================================================
+ Name        : uart.h
+ Description : USART0 output. Polled byte/text output and a DMA transmit
+ engine that sends a frame (header + payload) without CPU involvement.
+
+ The DMA transmit engine uses DMA channel 1, which is hard wired to the
+ USART0 TX DMA request (UM10800 §12.5.1, Table 159). It has its own
+ descriptor chain, independent of the channel 0 ADC chain.
+===============================================================================
+*/
+
+#ifndef UART_H_
+#define UART_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Largest supported baud rate. U_PCLK is derived from the main clock through the
+// fractional rate generator, and the USART oversample rate (OSR) can be reduced
+// from 16 down to 5, so that eg 3Mbaud is exact with a 60MHz main clock:
+// 60MHz / (1 + 64/256) / 16 = 3MHz.
+#define UART_BAUD_MAX 3000000
+
+// Reject baud rates that can't be generated to within this error
+#define UART_BAUD_MAX_ERROR_PPM 20000
+
+// Time to wait for the host to confirm a baud rate change before reverting
+#define UART_BAUD_CONFIRM_MS 250
+
+// Size of the receive ring buffer. Must be a power of 2.
+#define UART_RX_BUF_SIZE 32
+
+// Baud rate generator setting. Baud = main_clock / clkdiv / (1 + frgmult/256) / osr / brg
+typedef struct {
+	uint8_t clkdiv;		// UARTCLKDIV
+	uint8_t frgmult;	// UARTFRGMULT (UARTFRGDIV is always 0xFF)
+	uint8_t osr;		// Oversample rate 5 - 16 (OSR register + 1)
+	uint16_t brg;		// BRG register + 1
+	uint32_t baud;		// Actual baud rate
+	int32_t error_ppm;	// Baud rate error relative to the requested rate
+} UART_BAUD_CFG_T;
+
+// DMA channel for USART0 TX
+#define UART_DMA_CH DMA_CH1
+
+// Maximum payload for one uart_dma_send(). Each descriptor moves up to 1024 bytes.
+#define UART_DMA_MAX_PAYLOAD_DESC 5
+#define UART_DMA_MAX_PAYLOAD (UART_DMA_MAX_PAYLOAD_DESC * 1024)
+
+/**
+ * @brief Initialize USART0 for 8N1 at the given baud rate, with interrupt driven
+ * receive. Pins must already be assigned with the switch matrix.
+ * @param baud Baud rate
+ * @return None
+ */
+void uart_init (uint32_t baud);
+
+/**
+ * @brief Find the baud rate generator setting closest to the requested baud rate.
+ * @param clk_hz Main clock rate
+ * @param baud Requested baud rate
+ * @param cfg Best setting found
+ * @return false if no setting is within UART_BAUD_MAX_ERROR_PPM
+ */
+bool uart_baud_calc (uint32_t clk_hz, uint32_t baud, UART_BAUD_CFG_T *cfg);
+
+/**
+ * @brief Set the baud rate. Waits for the transmitter to be idle first.
+ * @param baud Requested baud rate
+ * @param error_ppm If not NULL, set to the error of the actual baud rate
+ * @return Actual baud rate, or 0 if the baud rate can't be generated (in which
+ * case the baud rate is unchanged)
+ */
+uint32_t uart_set_baud (uint32_t baud, int32_t *error_ppm);
+
+/**
+ * @brief Get the current actual baud rate.
+ * @return Baud rate
+ */
+uint32_t uart_get_baud (void);
+
+/**
+ * @brief Change baud rate with confirmation from the host. The reply 'b' followed
+ * by the actual baud rate and error in ppm (both 32 bit little-endian) is sent at
+ * the current rate, then the rate is changed. The host must then send 'K' at the
+ * new rate within UART_BAUD_CONFIRM_MS, which is answered with 'k'. Otherwise the
+ * previous rate is restored. If the rate can't be generated the reply is 'n'
+ * followed by the same fields and the rate is unchanged.
+ * @param baud Requested baud rate
+ * @return true if the new baud rate is in use
+ */
+bool uart_baud_handshake (uint32_t baud);
+
+/**
+ * @brief Get a received byte.
+ * @return Byte, or -1 if none received.
+ */
+int uart_getc (void);
+
+/**
+ * @brief Send one byte to UART. Block if UART busy.
+ * @param n Byte to send to UART.
+ * @return None.
+ */
+void print_byte (uint8_t n);
+
+/**
+ * @brief Sleep, rather than busy wait, in print_byte() while the transmitter is
+ * full. Must not be enabled if print_byte() is called with interrupts disabled
+ * or from a handler at or above the UART0 priority.
+ * @param sleep true to sleep
+ * @return None.
+ */
+void uart_tx_sleep (bool sleep);
+
+/**
+ * @brief Send a null terminated string to UART. Block if UART busy.
+ * @param s String to send.
+ * @return None.
+ */
+void print_string (const char *s);
+
+/**
+ * @brief Print a signed integer in decimal radix.
+ * @param n Number to print.
+ * @return None.
+ */
+void print_decimal (int n);
+
+// Longest fmt_decimal() output: sign and 10 digits
+#define UART_DEC_MAX 11
+
+/**
+ * @brief Format a signed integer in decimal radix without dividing: the last 4
+ * digits by reciprocal multiply, any above those by subtracting powers of 10.
+ * @param buf Output, at least UART_DEC_MAX chars. Not null terminated.
+ * @param n Number to format.
+ * @return Number of chars written.
+ */
+int fmt_decimal (char *buf, int n);
+
+/**
+ * @brief Format a signed integer in decimal radix with a /10 and %10 per digit,
+ * as print_decimal() used to. Only kept to benchmark fmt_decimal() against.
+ * @param buf Output, at least UART_DEC_MAX chars. Not null terminated.
+ * @param n Number to format.
+ * @return Number of chars written.
+ */
+int fmt_decimal_div (char *buf, int n);
+
+/**
+ * @brief Send a buffer to UART. Block until the last byte is in the TX FIFO.
+ * @param buf Data
+ * @param len Number of bytes
+ * @return None
+ */
+void uart_send_blocking (const uint8_t *buf, int len);
+
+/**
+ * @brief Setup DMA channel UART_DMA_CH for USART0 TX. The DMA controller must
+ * already be initialized and enabled.
+ * @return None
+ */
+void uart_dma_init (void);
+
+/**
+ * @brief Start sending a frame by DMA. Both buffers must remain unchanged until
+ * uart_dma_busy() returns false.
+ * @param hdr Header bytes (max 1024)
+ * @param hdr_len Number of header bytes
+ * @param payload Payload bytes
+ * @param len Number of payload bytes (max UART_DMA_MAX_PAYLOAD). May be 0.
+ * @return false if a previous transfer is still in progress, or the header or
+ * payload is too long (nothing is sent).
+ */
+bool uart_dma_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len);
+
+/**
+ * @brief Test if a DMA transfer started with uart_dma_send() is in progress.
+ * @return true if busy
+ */
+bool uart_dma_busy (void);
+
+/**
+ * @brief Handle DMA interrupt A for UART_DMA_CH. Call from DMA_IRQHandler.
+ * @return None
+ */
+void uart_dma_irq (void);
+
+#endif /* UART_H_ */
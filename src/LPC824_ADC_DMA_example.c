@@ -36,119 +36,2683 @@
 
 #include <cr_section_macros.h>
 
+#include <string.h>
+
+#include "block_queue.h"
+#include "systick.h"
+#include "frame.h"
+#include "uart.h"
+#include "spi.h"
+#include "transport.h"
+#include "history.h"
+#include "command.h"
+#include "decimate.h"
+#include "goertzel.h"
+#include "fft.h"
+#include "blockstats.h"
+#include "rice.h"
+#include "instr.h"
+#include "mtb_trace.h"
+#include "ramfunc.h"
+
 //
-// Hardware configuration
+// Hardware configuration. ADC_CHANNEL, ADC_SAMPLE_RATE, CAPTURE_MODE, DMA_BUFFER_SIZE
+// and DMA_NUM_BLOCKS are the configuration at reset, which can be changed at run
+// time with commands on the UART (see commands[]).
 //
+// Initial baud rate. The host can switch to a higher rate (up to UART_BAUD_MAX)
+// with a handshake, see uart_baud_handshake().
 #define UART_BAUD_RATE 115200
 #define ADC_CHANNEL 3
 #define ADC_SAMPLE_RATE 500000
 
-// Define function to pin mapping. Pin numbers here refer to PIO0_n
-// and is not the same as a package pin number.
-// Use PIO0_0 and PIO0_4 for UART RXD, TXD (same as ISP)
-#define PIN_UART_RXD 0
-#define PIN_UART_TXD 4
-// General purpose debug pin
-#define PIN_DEBUG 14
-// Assign SCT0_OUT3 to external pin for debugging
-#define PIN_SCT_DEBUG 15
+// Capture mode. ONESHOT captures DMA_NUM_BLOCKS blocks, stops the ADC and dumps
+// the buffer to the UART. STREAM links the last DMA descriptor back to the
+// first so the ADC samples without stopping; each completed block is handed
+// to the main loop while the DMA fills the next one. HISTORY samples without
+// stopping into a small ring of HIST_STAGE_BLOCKS staging blocks; each staging
+// block is packed to 12 bits (see history.h) into a history ring in the rest of
+// adc_buffer while the DMA fills the next one. When the history is full capture
+// stops and the history is output: 3924 samples instead of 3072 in the same
+// memory. TRIGGER runs the DMA ring continuously and arms the ADC threshold
+// compare on the lowest channel; when the signal crosses TRIG_LEVEL the DMA
+// position is recorded, capture continues for TRIG_POST samples, then the
+// window of TRIG_PRE + TRIG_POST samples around the crossing is output and the
+// trigger is re-armed.
+#define CAPTURE_MODE_ONESHOT 0
+#define CAPTURE_MODE_STREAM 1
+#define CAPTURE_MODE_HISTORY 2
+#define CAPTURE_MODE_TRIGGER 3
+#define CAPTURE_MODE CAPTURE_MODE_ONESHOT
+
+// Output format. TEXT is one "record-number adc-value" line per sample (for
+// GnuPlot, see data/capture.dat). BINARY sends each block as a frame of packed
+// 12 bit samples (see frame.h): 1.5 bytes per sample instead of about 10. RAW
+// sends the 16 bit ADC data register values as they are (the host does the >>4),
+// which needs no processing on the target other than the CRC. RICE sends each
+// block delta + Rice coded (see rice.h), lossless: about 1.1 bytes per sample for
+// data/capture.dat, less for slower signals, never more than 2.
+#define OUTPUT_FORMAT_TEXT 0
+#define OUTPUT_FORMAT_BINARY 1
+#define OUTPUT_FORMAT_RAW 2
+#define OUTPUT_FORMAT_RICE 3
+#define OUTPUT_FORMAT OUTPUT_FORMAT_TEXT
+
+// CAPTURE_MODE_TRIGGER threshold (12 bit ADC value, either direction) and
+// window, in samples per channel. The window must fit in all but 2 blocks of the
+// DMA ring: TRIG_PRE + TRIG_POST <= (blocks - 2) * size / channels. Smaller
+// blocks make more of the ring usable, eg "blocks 12", "size 256" allows 2560.
+#define TRIG_LEVEL 2048
+#define TRIG_PRE 256
+#define TRIG_POST 768
+
+// Block processing in CAPTURE_MODE_STREAM and CAPTURE_MODE_ONESHOT (single channel
+// except STATS).
+// NONE outputs the samples. DECIMATE filters and decimates by 2 * DECIM_R (see
+// decimate.h) and outputs the Q15 result: with DECIM_R 5, 500ksps becomes 50ksps.
+// GOERTZEL measures TONE_BINS tones TONE_STEP Hz apart centred on TONE_FREQ (see
+// goertzel.h) and outputs one magnitude per bin per block. Bins must be between
+// rate / 256 and rate / 2. FFT outputs the power spectrum of each block (see
+// fft.h), size / 2 bins: the block size must be a power of 2 (eg 256, 512, 1024).
+// STATS outputs only min, max, mean, RMS and crossings of each channel of each
+// block (see blockstats.h), flagging an alarm if a sample is outside ALARM_LO -
+// ALARM_HI. WINDOW (stream mode) outputs nothing: each block goes to windowFn, a
+// lightweight callback for closed-loop use with short blocks (see LOW_LATENCY).
+// The default, window_level(), drives PIN_DEBUG high while samples are at or
+// above TRIG_LEVEL.
+#define PROC_NONE 0
+#define PROC_DECIMATE 1
+#define PROC_GOERTZEL 2
+#define PROC_FFT 3
+#define PROC_STATS 4
+#define PROC_WINDOW 5
+#define PROCESS PROC_NONE
+#define DECIM_R 5
+#define TONE_FREQ 40000
+#define TONE_STEP 1000
+#define TONE_BINS 5
+#define ALARM_LO 0
+#define ALARM_HI 4095
+
+// Experimental dual sequencer capture (the "seq dual" command, or at reset if
+// DUAL_SEQ is 1): single channel, oneshot or stream. SCT0_OUT3 is a square wave
+// of the sample period; SEQB converts on its falling edge and SEQA on its rising
+// edge, half a period later. Each sequencer has its own DMA channel and
+// descriptor ring, and the two write alternate samples of the same blocks, so the
+// blocks hold one time ordered stream at twice the SCT rate. The ADC converts one
+// sample at a time, so the combined rate can't really exceed ADC_MAX_SAMPLE_RATE;
+// rates up to twice that are accepted to find the real ceiling ("bench" and the
+// "dual_slips" stats field).
+#define DUAL_SEQ 0
+
+// Fractional sample period (the "clock frac" command, or at reset if
+// SCT_FRACTIONAL is 1). A rate that isn't a whole number of system clocks per
+// sample, eg 44100Hz (680.27 clocks), is made by alternating periods of N and
+// N+1 clocks. A phase accumulator spreads the longer periods evenly over a
+// pattern of up to SCT_FRAC_MAX_LEN periods, and SCT_FRAC_DMA_CH, triggered by the
+// SCT at the end of each period, writes the next one to the SCT_MATCH_0 reload
+// register, without the CPU. The average rate is exact when the period is a
+// fraction of a clock with a denominator up to SCT_FRAC_MAX_LEN (160kHz is 187.5
+// clocks), otherwise within 1/128 clock per sample; "rate_x1000" in replies is
+// the average rate in mHz. The sample timing jitters by one clock.
+#define SCT_FRACTIONAL 0
+#define SCT_FRAC_MAX_LEN 64
+
+// Number of PIN_DEBUG pulses at the end of each DMA block, to see block timing on
+// an oscilloscope. Each pulse adds a few cycles to DMA_IRQHandler; 0 for none (the
+// "instr" command reports timing without a scope, see instr.h).
+#define DEBUG_PIN_PULSES 8
+
+// Stream mode block completion (the "irq" command). 1: each block raises
+// DMA_IRQHandler, which publishes it to the main loop. 0: the descriptor ring
+// runs with no interrupts; the main loop polls the ADC DMA channel's remaining
+// transfer count and publishes the blocks itself (see ring_poll()), so small
+// blocks cost no ISR time. N > 1: polled, but every Nth descriptor interrupts to
+// wake the core from sleep, so the latency is up to N blocks; with 0 the main
+// loop doesn't sleep.
+#define RING_IRQ 1
+
+// Benchmark (the "bench" command, or at reset if BENCH_AT_START is 1): for each
+// block processing kernel, sweep the single channel sample rate from
+// BENCH_RATE_STEP up to ADC_MAX_SAMPLE_RATE (twice that with dual sequencer
+// capture) in BENCH_RATE_STEP steps, running BENCH_BLOCKS blocks of 1024 samples
+// at each rate with no UART output. Stops at the first rate that loses a block,
+// overruns the ADC, slips (dual sequencer capture) or lags (the consumer finds
+// all but one block of the ring waiting). "make bench" builds with BENCH_AT_START 1.
+#ifndef BENCH_AT_START
+#define BENCH_AT_START 0
+#endif
+#define BENCH_RATE_STEP 50000
+#define BENCH_BLOCKS 32
+
+// If 1 stream with the least CPU wake time: print_byte() sleeps for each byte of
+// text output and replies rather than busy waiting (see uart_tx_sleep()), and
+// the brown out detector is powered down. The core always sleeps (Sleep mode)
+// while waiting for a block or for a frame to be sent. Deep-sleep and power-down
+// aren't used as they stop the system clock, which the ADC, SCT and DMA need.
+// The "instr" command reports the active duty cycle.
+#define LOW_POWER 0
+
+// If 1 binary frames are sent by DMA (see uart.h) so that the CPU is free, and
+// can sleep, while a frame is being sent. If 0 frames are sent with print_byte().
+#define UART_TX_DMA 1
+
+// If 1 binary frames are sent on SPI0 (see spi.h) rather than USART0, at up to
+// SPI_BITRATE, so that raw 500ksps streaming fits. Also the "link" command. Text
+// output and command replies stay on USART0.
+#define FRAME_SPI 0
+#define SPI_BITRATE 15000000
+
+// Stream mode back-pressure (the "policy" command): what to do with a block sent
+// as binary samples (no processing) when the link would still be sending it as
+// the DMA comes round to overwrite it. See stream_output_block().
+#define BP_NONE 0		// Send it anyway: the frame may be corrupted, counted in overruns
+#define BP_DROP 1		// Drop the whole block, leaving a gap in the frame sequence numbers
+#define BP_DECIMATE 2	// Halve its sample rate (average pairs) until it fits, else drop it
+#define BP_COMPRESS 3	// Rice code it, drop it if that is still too long
+#define BACKPRESSURE BP_DROP
+
+// Define function to pin mapping. Pin numbers here refer to PIO0_n
+// and is not the same as a package pin number.
+// Use PIO0_0 and PIO0_4 for UART RXD, TXD (same as ISP)
+#define PIN_UART_RXD 0
+#define PIN_UART_TXD 4
+// General purpose debug pin
+#define PIN_DEBUG 14
+// Assign SCT0_OUT3 to external pin for debugging
+#define PIN_SCT_DEBUG 15
+// SPI0 frame output (not on the 20 pin package)
+#define PIN_SPI_SCK 24
+#define PIN_SPI_MOSI 25
+#define PIN_SPI_SSEL 26
+
+
+#define DMA_BUFFER_SIZE 1024
+// Number of DMA_BUFFER_SIZE blocks in adc_buffer (one descriptor per block)
+#define DMA_NUM_BLOCKS 3
+// Size of adc_buffer in samples
+#define ADC_BUFFER_SIZE (DMA_BUFFER_SIZE*DMA_NUM_BLOCKS)
+// Longest descriptor chain that can be set at run time
+#define DMA_MAX_BLOCKS 16
+
+// Low latency configuration at reset if 1 (or "size 16", "blocks 16", "proc
+// window"): stream mode, a ring of DMA_MAX_BLOCKS blocks of LOWLAT_BLOCK_SIZE
+// samples, PROC_WINDOW. A block is handed to windowFn LOWLAT_BLOCK_SIZE sample
+// periods after its first sample, 32us at 500ksps, instead of 2ms for 1024
+// samples. The "stats" fields lat_us and lat_max_us are the measured times from
+// the ADC trigger of a sample crossing TRIG_LEVEL to PIN_DEBUG going high.
+#define LOW_LATENCY 0
+#define LOWLAT_BLOCK_SIZE 16
+// DMA channel of ADC sequencer B in dual sequencer capture
+#define DUAL_DMA_CH DMA_CH2
+// DMA channel writing the fractional sample period pattern to the SCT
+#define SCT_FRAC_DMA_CH DMA_CH3
+
+// Maximum number of ADC channels captured at the same time
+#define ADC_MAX_CHANNELS 4
+
+// ADC channels that can be selected at run time. ADC2 is on PIO0_14 (PIN_DEBUG)
+// and ADC11 is on PIO0_4 (PIN_UART_TXD).
+#define ADC_CHANNELS_AVAIL (0xfff & ~((1 << 2) | (1 << 11)))
+
+// CAPTURE_MODE_HISTORY staging ring at the start of adc_buffer, HIST_STAGE_BLOCKS
+// blocks of HIST_STAGE_SIZE samples (must be even). The history ring uses the rest
+// of adc_buffer: (6144 - 256) bytes / 1.5 = 3924 samples. Smaller staging blocks
+// leave more room for history but mean more frequent DMA interrupts: each block
+// must be packed within (HIST_STAGE_BLOCKS-1) * HIST_STAGE_SIZE sample periods
+// (128us at 500ksps).
+#define HIST_STAGE_SIZE 64
+#define HIST_STAGE_BLOCKS 2
+
+// Switch matrix fixed pin function of each ADC channel
+static const uint8_t adcFixedPin[12] = {
+	SWM_FIXED_ADC0, SWM_FIXED_ADC1, SWM_FIXED_ADC2, SWM_FIXED_ADC3,
+	SWM_FIXED_ADC4, SWM_FIXED_ADC5, SWM_FIXED_ADC6, SWM_FIXED_ADC7,
+	SWM_FIXED_ADC8, SWM_FIXED_ADC9, SWM_FIXED_ADC10, SWM_FIXED_ADC11
+};
+
+// Capture configuration. Set at run time with commands.
+typedef struct {
+	uint8_t mode;			// CAPTURE_MODE_*
+	uint16_t chan_mask;		// ADC_SEQ_CTRL_CHANSEL mask, 1 - ADC_MAX_CHANNELS channels
+	uint16_t block_size;	// DMA transfer count per descriptor (max 1024)
+	uint16_t num_blocks;	// Number of chained descriptors (DMA_MAX_BLOCKS max)
+	uint32_t match0;		// Sample period in system clocks (SCT_MATCH_0 reload + 1)
+	uint32_t match2;		// SCT_MATCH_2 reload: SCT0_OUT3 high time in system clocks
+	uint16_t trig_level;	// CAPTURE_MODE_TRIGGER threshold
+	uint16_t trig_pre;		// CAPTURE_MODE_TRIGGER samples per channel before the crossing
+	uint16_t trig_post;		// CAPTURE_MODE_TRIGGER samples per channel from the crossing
+	uint8_t proc;			// PROC_*
+	uint8_t decim_r;		// PROC_DECIMATE CIC rate change
+	uint8_t tone_bins;		// PROC_GOERTZEL number of bins
+	uint16_t tone_step;		// PROC_GOERTZEL bin spacing in Hz
+	uint32_t tone_freq;		// PROC_GOERTZEL centre frequency in Hz
+	uint16_t alarm_lo;		// PROC_STATS alarm if min < alarm_lo
+	uint16_t alarm_hi;		// PROC_STATS alarm if max > alarm_hi
+	bool dual;				// Dual sequencer capture (see DUAL_SEQ)
+	bool frac;				// Fractional sample period (see SCT_FRACTIONAL)
+	uint8_t frac_num;		// The period is match0 + frac_num / frac_len system clocks
+	uint8_t frac_len;		// Periods in the pattern, 1 - SCT_FRAC_MAX_LEN
+	uint8_t bp;				// BP_* back-pressure policy
+	uint8_t ring_irq;		// Block interrupts, see RING_IRQ
+} CAPTURE_CONFIG_T;
+
+static CAPTURE_CONFIG_T cfg;
+static bool captureRunning = false;
+// Actual sample rate of cfg, per channel
+static uint32_t sampleRate;
+// Number of channels in cfg.chan_mask
+static int numChannels;
+// Time taken by the last capture restart, in SysTick (system clock) cycles
+static uint32_t restartCycles;
+
+// Reload descriptors must be 16 byte aligned (UM10800 §12.6.3)
+static DMA_CHDESC_T dmaDesc[DMA_MAX_BLOCKS] __attribute__ ((aligned(16)));
+// Dual sequencer capture: descriptors of the SEQB channel, DUAL_DMA_CH
+static DMA_CHDESC_T dmaDescB[DMA_MAX_BLOCKS] __attribute__ ((aligned(16)));
+// Fractional sample period: SCT_MATCH_0 values of the period pattern, and the
+// descriptor looping SCT_FRAC_DMA_CH over them
+static uint32_t sctPeriods[SCT_FRAC_MAX_LEN];
+static DMA_CHDESC_T sctFracDesc __attribute__ ((aligned(16)));
+
+// This is where we put ADC results
+static uint16_t adc_buffer[ADC_BUFFER_SIZE];
+
+// Polled descriptor ring (cfg.ring_irq != 1): DMA position at the last ring_poll()
+static uint32_t ringPollTime;		// systick_now()
+static uint32_t ringPollPos;		// Samples transferred in the current block
+static uint32_t ringBlockCycles;	// Less than the shortest time to fill a block
+// DMA interrupts that only woke the core (cfg.ring_irq > 1)
+static volatile uint32_t ringWakes;
+
+// Completed DMA blocks, published by DMA_IRQHandler and consumed by main()
+static BLOCKQ_T blockq;
+
+// CAPTURE_MODE_TRIGGER state, shared with the ADC and DMA interrupt handlers
+static volatile bool trigArmed;
+static volatile bool trigFired;
+// Window complete: capture halted, window not yet output
+static volatile bool trigWindowReady;
+// Sample number (all channels, since capture start) of the crossing
+static volatile uint32_t trigSample;
+// Number of windows output
+static uint32_t trigWindows;
+
+// ADC overrun interrupts since capture start: each is at least one sample lost
+// because the DMA didn't read a result before the next conversion completed
+static volatile uint32_t adcOverruns;
+
+// Dual sequencer capture: SEQB blocks complete, and blocks at the end of which the
+// sequencers were out of step (SEQB should complete each block half a sample
+// period before SEQA). After a slip the samples are no longer in time order.
+static volatile uint32_t dualBlocks;
+static volatile uint32_t dualSlips;
+
+// PROC_DECIMATE filter state, kept across blocks
+static DECIM_T decim;
+// PROC_DECIMATE output samples since capture start
+static uint32_t decimCount;
+// PROC_GOERTZEL bins
+static GOERTZEL_T goertzel;
+// PROC_STATS number of channel blocks outside the alarm limits
+static uint32_t alarmCount;
+// PROC_WINDOW callback, called with each block as soon as it is complete: the
+// block's ADC data register values and its completion time (systick_now())
+typedef void (*WINDOW_FN_T)(const uint16_t *buf, int n, uint32_t timestamp);
+static void window_level (const uint16_t *buf, int n, uint32_t timestamp);
+static WINDOW_FN_T windowFn = window_level;
+// window_level() output state, number of rising edges, and the last and longest
+// latency from a sample's ADC trigger to the edge, in system clock cycles
+static bool windowHigh;
+static uint32_t windowEvents;
+static uint32_t windowLatency;
+static uint32_t windowLatencyMax;
+// Time taken to process the last block, in SysTick (system clock) cycles
+static uint32_t procCycles;
+// Back-pressure: blocks dropped, or refused by the link (frame_send()), and
+// blocks sent decimated or compressed
+static uint32_t bpShed;
+static uint32_t bpReduced;
+
+// CAPTURE_MODE_HISTORY packed sample history, one ring per channel
+static HIST_T hist[ADC_MAX_CHANNELS];
+// CAPTURE_MODE_HISTORY staging block size: HIST_STAGE_SIZE rounded down so that
+// each block has an even number of samples of each channel
+static int histStageSize;
+
+
+/**
+ * @brief Pulse debugging pin to indicate an event on a oscilloscope trace.
+ * @param n Number of times to pulse the pin.
+ * @return None
+ */
+HOT_FUNC(debug_pin_pulse)
+static void debug_pin_pulse (int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, true);
+		Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, false);
+	}
+}
+
+/**
+ * @brief Channel the threshold compare runs on: the lowest of cfg.chan_mask, which
+ * is the first of each sequence.
+ */
+static int trigger_channel (void)
+{
+	return __builtin_ctz(cfg.chan_mask);
+}
+
+/**
+ * @brief Enable the threshold crossing interrupt on the trigger channel.
+ * @return None
+ */
+static void trigger_arm (void)
+{
+	int ch = trigger_channel();
+
+	// Compare flags are set whether or not the interrupt is enabled: clear any
+	// crossing from before the trigger was armed.
+	Chip_ADC_ClearFlags(LPC_ADC, ADC_FLAGS_THCMP_MASK(ch) | ADC_FLAGS_THCMP_INT_MASK);
+	NVIC_ClearPendingIRQ(ADC_THCMP_IRQn);
+	Chip_ADC_EnableInt(LPC_ADC, ADC_INTEN_CMP_ENABLE(ADC_INTEN_CMP_CROSSTH, ch));
+	trigArmed = true;
+}
+
+/**
+ * @brief Disable the threshold crossing interrupt.
+ * @return None
+ */
+static void trigger_disarm (void)
+{
+	Chip_ADC_DisableInt(LPC_ADC, ADC_INTEN_CMP_ENABLE(ADC_INTEN_CMP_CROSSTH, trigger_channel()));
+	trigArmed = false;
+}
+
+/**
+ * @brief CAPTURE_MODE_TRIGGER: called from DMA_IRQHandler after each block. Arms
+ * the trigger once the ring holds enough pre-trigger samples, and halts the SCT
+ * once the block holding the last post-trigger sample is complete. The DMA has
+ * moved on to the next block by then, but at most a few samples of it (the
+ * oldest block in the ring) are overwritten before the SCT stops.
+ * @return None
+ */
+static void trigger_block_done (void)
+{
+	uint32_t stored = blockq.produced * cfg.block_size;
+
+	if ( ! trigArmed && ! trigFired && stored >= (uint32_t)cfg.trig_pre * numChannels) {
+		trigger_arm();
+	}
+
+	if (trigFired && ! trigWindowReady
+			&& stored >= trigSample + (uint32_t)cfg.trig_post * numChannels) {
+		Chip_SCT_SetControl(LPC_SCT, SCT_CTRL_HALT_L);
+		trigWindowReady = true;
+	}
+}
+
+/**
+ * @brief	ADC threshold compare interrupt handler. Records the DMA position of the
+ * crossing: blocks completed plus transfers done in the current block. The
+ * crossing sample's DMA transfer is requested at the same time as this
+ * interrupt, so the position is accurate to +/- 1 sample.
+ * @return	None
+ */
+void ADC_THCMP_IRQHandler (void)
+{
+	uint32_t done, remaining;
+
+	INSTR_ISR_BEGIN(INSTR_THCMP_ISR);
+	// One trigger per window
+	trigger_disarm();
+	Chip_ADC_ClearFlags(LPC_ADC, ADC_FLAGS_THCMP_MASK(trigger_channel()) | ADC_FLAGS_THCMP_INT_MASK);
+
+	// DMA_IRQHandler has higher priority, so produced is updated shortly after
+	// a descriptor reload. Retry if it changed while reading XFERCOUNT.
+	do {
+		done = blockq.produced;
+		remaining = ((LPC_DMA->DMACH[DMA_CH0].XFERCFG >> 16) & 0x3ff) + 1;
+	} while (done != blockq.produced);
+
+	// Index of the last sample transferred, rounded down to the start of its
+	// sequence (the trigger channel is first in each sequence).
+	uint32_t pos = done * cfg.block_size + (cfg.block_size - remaining);
+	if (pos > 0) {
+		pos--;
+	}
+	trigSample = pos - pos % numChannels;
+	trigFired = true;
+	INSTR_ISR_END(INSTR_THCMP_ISR);
+}
+
+/**
+ * @brief ADC overrun interrupt. Only enabled for single channel capture, where the
+ * DMA reads the channel data register: the overrun clears when it is read. With
+ * several channels the DMA reads SEQ_GDAT and the channel data registers are left
+ * unread, so their overrun flags would stay set.
+ * @return None
+ */
+void ADC_OVR_IRQHandler (void)
+{
+	adcOverruns++;
+	Chip_ADC_ClearFlags(LPC_ADC, ADC_FLAGS_OVRRUN_INT_MASK);
+	NVIC_ClearPendingIRQ(ADC_OVR_IRQn);
+}
+
+/**
+ * @brief	DMA Interrupt Handler
+ * @return	None
+ */
+HOT_FUNC(DMA_IRQHandler)
+void DMA_IRQHandler(void)
+{
+	uint32_t inta;
+
+	MTB_TRACE_BEGIN();
+	INSTR_ISR_BEGIN(INSTR_DMA_ISR);
+	inta = Chip_DMA_GetActiveIntAChannels(LPC_DMA);
+
+	// Before DMA_CH0, as each SEQB block completes first
+	if (inta & (1 << DUAL_DMA_CH)) {
+		Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DUAL_DMA_CH);
+		dualBlocks++;
+	}
+
+	if ((inta & (1 << DMA_CH0)) && cfg.ring_irq != 1) {
+		// Polled ring: the main loop publishes the blocks, this only wakes it
+		Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DMA_CH0);
+		ringWakes++;
+	} else if (inta & (1 << DMA_CH0)) {
+		// Pulse debug pin so can see when each DMA block ends on scope trace.
+		// PROC_WINDOW uses the pin as its output.
+		if (cfg.proc != PROC_WINDOW) {
+			debug_pin_pulse (DEBUG_PIN_PULSES);
+		}
+
+		// Clear DMA interrupt for the channel
+		Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DMA_CH0);
+
+		// Hand the completed block to the main loop. In one-shot mode the main loop
+		// is done when DMA_NUM_BLOCKS blocks have been produced.
+		blockq_publish(&blockq, systick_now());
+		if (cfg.dual && dualBlocks != blockq.produced) {
+			dualSlips++;
+		}
+
+		if (cfg.mode == CAPTURE_MODE_TRIGGER) {
+			trigger_block_done();
+		}
+	}
+
+	if (inta & (1 << UART_DMA_CH)) {
+		// Frame transmit complete
+		uart_dma_irq();
+	}
+	if (inta & (1 << SPI_DMA_CH)) {
+		spi_dma_irq();
+	}
+	INSTR_ISR_END(INSTR_DMA_ISR);
+	MTB_TRACE_END();
+}
+
+/**
+ * @brief Setup a chain of DMA descriptors, one per block.
+ * @param desc Descriptors, num_blocks of them
+ * @param src ADC register the DMA copies samples from
+ * @param buf Start of first block
+ * @param block_size Block size in samples (max 1024)
+ * @param num_blocks Number of blocks (max DMA_NUM_BLOCKS)
+ * @param stride 1 to fill every sample of each block, 2 for every other sample
+ * (dual sequencer capture: each sequencer fills half of each block)
+ * @param ring If true the last descriptor links back to the first so that capture
+ * continues indefinitely. If false the chain ends after the last block.
+ * @param irq_every Interrupt A at the end of every block (1), every Nth block, or
+ * none (0)
+ * @return None
+ */
+static void dma_setup_descriptors (DMA_CHDESC_T *desc, volatile uint32_t *src, uint16_t *buf,
+		int block_size, int num_blocks, int stride, bool ring, int irq_every)
+{
+	const int count = block_size / stride;
+	int i;
+
+	// DMA descriptor for ADC to memory - note that addresses must
+	// be the END address for source and destination, not the starting address.
+	// DMA operations moves from end to start. [Ref ].
+	for (i = 0; i < num_blocks; i++) {
+		desc[i].xfercfg = (
+				DMA_XFERCFG_CFGVALID  // Channel descriptor is considered valid
+				| DMA_XFERCFG_RELOAD  // Causes DMA to move to next descriptor when complete
+				| DMA_XFERCFG_SETINTA // DMA Interrupt A (A vs B can be read in ISR)
+				| DMA_XFERCFG_WIDTH_16 // 8,16,32 bits allowed
+				| DMA_XFERCFG_SRCINC_0 // do not increment source
+				| (stride == 1 ? DMA_XFERCFG_DSTINC_1 : DMA_XFERCFG_DSTINC_2) // increment dst by width x stride
+				| DMA_XFERCFG_XFERCOUNT(count)
+				);
+		// ADC data register is source of DMA
+		desc[i].source = DMA_ADDR ( src );
+		desc[i].dest = DMA_ADDR(&buf[block_size*i + (count - 1)*stride]) ;
+		desc[i].next = DMA_ADDR(&desc[(i+1) % num_blocks]);
+		if (irq_every == 0 || (i + 1) % irq_every != 0) {
+			desc[i].xfercfg &= ~DMA_XFERCFG_SETINTA;
+		}
+	}
+
+	if ( ! ring) {
+		// Last block: no reload, no more descriptors
+		desc[num_blocks-1].xfercfg &= ~DMA_XFERCFG_RELOAD;
+		desc[num_blocks-1].next = DMA_ADDR(0);
+	}
+}
+
+/**
+ * @brief Output a block of ADC data register values to UART as text. Bits 15:4 of the
+ * ADC data register hold the ADC value, so each value is shifted 4 bits right to
+ * yield 12 bit ADC data in range 0 - 4095 as it is printed.
+ * Format: record-number adc-value. One record per line.  Suggest using GnuPlot to plot them.
+ * With several channels the samples of each sequence are de-interleaved into
+ * columns: record-number adc-value-1 adc-value-2 ... in ascending channel order.
+ * @param buf Start of block in adc_buffer
+ * @param n Number of samples in block (a multiple of numChannels)
+ * @param first_record Record number of the first sample in the block
+ * @return None
+ */
+HOT_FUNC(output_block_text)
+static void output_block_text (const uint16_t *buf, int n, int first_record)
+{
+	char line[UART_DEC_MAX + ADC_MAX_CHANNELS * 5 + 1];
+	int i, c, len;
+	int record = first_record;
+
+	for (i = 0; i < n; i += numChannels) {
+
+		// It would be nice to use libc, but complicates packing up for others to use.
+		//printf ("%d %d\n", i, buf[i]>>4);
+
+		// Format the line with fmt_decimal() (no divides) and send it in one go.
+		// Values are 12 bit so never more than 4 digits.
+		len = fmt_decimal(line, record++);
+		for (c = 0; c < numChannels; c++) {
+			line[len++] = ' ';
+			len += fmt_decimal(&line[len], buf[i + c] >> 4);
+		}
+		line[len++] = '\n';
+		uart_send_blocking((const uint8_t *)line, len);
+	}
+}
+
+/**
+ * @brief Start processing a block: MTB trace (in a profiling build) from here to
+ * proc_done().
+ * @return systick_now(), for proc_done()
+ */
+static uint32_t proc_begin (void)
+{
+	MTB_TRACE_BEGIN();
+	return systick_now();
+}
+
+/**
+ * @brief Record the time taken to process a block, in procCycles and INSTR_PROC.
+ * @param start proc_begin() when processing started
+ * @return None
+ */
+static void proc_done (uint32_t start)
+{
+	procCycles = systick_elapsed(start, systick_now());
+	INSTR_RECORD(INSTR_PROC, procCycles);
+	MTB_TRACE_END();
+}
+
+/**
+ * @brief Start a frame: serialize the header with the CRC field zero and restart
+ * the CRC engine with the header bytes covered by the CRC.
+ * @param h Header. crc is ignored, ratio is set from type and lengths and the
+ * loss counters from adcOverruns, blockq and bpShed.
+ * @param hdr Frame header output, FRAME_HEADER_LEN bytes
+ * @return None
+ */
+static void frame_begin (FRAME_HEADER_T *h, uint8_t *hdr)
+{
+	int i;
+
+	h->version = FRAME_VERSION;
+	h->ratio = frame_ratio(h->type, h->sample_count, h->payload_len);
+	h->adc_overruns = adcOverruns;
+	h->lost_blocks = blockq.overruns + blockq.dropped + bpShed;
+	h->crc = 0;
+	frame_header_write(h, hdr);
+
+	// CRC engine in CCITT mode matches frame_crc16()
+	Chip_CRC_UseCCITT();
+	for (i = FRAME_CRC_START; i < FRAME_CRC_END; i++) {
+		Chip_CRC_Write8(hdr[i]);
+	}
+}
+
+/**
+ * @brief Finish a frame once all payload bytes have been fed to the CRC engine.
+ * @param h Header
+ * @param hdr Frame header output, FRAME_HEADER_LEN bytes
+ * @return None
+ */
+static void frame_end (FRAME_HEADER_T *h, uint8_t *hdr)
+{
+	h->crc = Chip_CRC_Sum();
+	frame_header_write(h, hdr);
+}
+
+/**
+ * @brief Feed bytes to the CRC engine.
+ * @param p Data
+ * @param len Number of bytes
+ * @return None
+ */
+static void crc_write_bytes (const uint8_t *p, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		Chip_CRC_Write8(p[i]);
+	}
+}
+
+/**
+ * @brief Convert a block of ADC data register values to packed 12 bit samples (see
+ * frame.h) in place, feeding the output to the CRC engine. The >>4 shift, the
+ * packing and the CRC are done in one pass, so each sample is read exactly once.
+ * @param buf Block of ADC data register values. Overwritten with packed samples.
+ * @param n Number of samples
+ * @return Number of bytes written
+ */
+static int pack12_dr_crc (uint16_t *buf, int n)
+{
+	uint8_t *p = (uint8_t *)buf;
+	int i;
+
+	// Both samples are read before any output byte is written, and output
+	// never gets ahead of input, so packing in place is safe.
+	for (i = 0; i + 1 < n; i += 2) {
+		uint32_t a = buf[i] >> 4;
+		uint32_t b = buf[i+1] >> 4;
+		p[0] = a;
+		p[1] = (a >> 8) | (b << 4);
+		p[2] = b >> 4;
+		Chip_CRC_Write8(p[0]);
+		Chip_CRC_Write8(p[1]);
+		Chip_CRC_Write8(p[2]);
+		p += 3;
+	}
+	if (i < n) {
+		uint32_t a = buf[i] >> 4;
+		p[0] = a;
+		p[1] = a >> 8;
+		Chip_CRC_Write8(p[0]);
+		Chip_CRC_Write8(p[1]);
+		p += 2;
+	}
+	return p - (uint8_t *)buf;
+}
+
+/**
+ * @brief Frame type for samples in OUTPUT_FORMAT.
+ */
+static uint8_t sample_frame_type (void)
+{
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_RAW) {
+		return FRAME_TYPE_RAW16;
+	}
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_RICE) {
+		return FRAME_TYPE_RICE;
+	}
+	return FRAME_TYPE_PACKED12;
+}
+
+/**
+ * @brief Build a frame from a block of ADC data register values. For
+ * FRAME_TYPE_PACKED12 the samples are shifted and packed in place, so the block
+ * becomes the frame payload. For FRAME_TYPE_RAW16 the block is the payload as is.
+ * For FRAME_TYPE_RICE the block is coded in place first, as the header needs the
+ * coded length, then fed to the CRC engine. The time taken is kept in procCycles.
+ * @param type FRAME_TYPE_PACKED12, FRAME_TYPE_RAW16 or FRAME_TYPE_RICE
+ * @param buf Start of block in adc_buffer
+ * @param n Number of samples in block
+ * @param rate Sample rate per channel
+ * @param seq Frame sequence number
+ * @param hdr Frame header output, FRAME_HEADER_LEN bytes
+ * @return Payload length in bytes
+ */
+static int frame_prepare_samples (uint8_t type, uint16_t *buf, int n, uint32_t rate, uint32_t seq, uint8_t *hdr)
+{
+	FRAME_HEADER_T h;
+	uint32_t start = proc_begin();
+
+	h.type = type;
+	h.seq = seq;
+	h.sample_rate = rate;
+	h.sample_count = n;
+	h.chan_mask = cfg.chan_mask;
+	if (type == FRAME_TYPE_RICE) {
+		h.payload_len = rice_encode_dr(buf, n, numChannels);
+	} else {
+		h.payload_len = (type == FRAME_TYPE_RAW16) ? 2*n : frame_packed12_len(n);
+	}
+	frame_begin(&h, hdr);
+
+	if (type != FRAME_TYPE_PACKED12) {
+		crc_write_bytes((const uint8_t *)buf, h.payload_len);
+	} else {
+		pack12_dr_crc(buf, n);
+	}
+
+	frame_end(&h, hdr);
+	proc_done(start);
+	return h.payload_len;
+}
+
+/**
+ * @brief Send a frame on the selected transport. This waits for the previous frame
+ * to finish, starts sending this frame and, with a DMA backend, returns while it is
+ * being sent: header and payload must not be reused until transport_busy() is false.
+ * @param hdr Frame header, FRAME_HEADER_LEN bytes
+ * @param payload Frame payload
+ * @param len Payload length in bytes
+ * @return false if the backend refused the frame (see TRANSPORT_T.send): the
+ * caller counts it in bpShed, as the frame is lost
+ */
+static bool frame_send (const uint8_t *hdr, const uint8_t *payload, int len)
+{
+	// Save power by sleeping until the previous frame has been sent.
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+	return transport_send(hdr, FRAME_HEADER_LEN, payload, len);
+}
+
+/**
+ * @brief Get a frame header buffer. There are two, used alternately, so that the
+ * next frame can be prepared while the previous one is still being sent.
+ * @return Header buffer, FRAME_HEADER_LEN bytes
+ */
+static uint8_t *frame_header_buf (void)
+{
+	static uint8_t hdr[2][FRAME_HEADER_LEN];
+	static int hdrIdx = 0;
+
+	hdrIdx ^= 1;
+	return hdr[hdrIdx];
+}
+
+/**
+ * @brief PROC_DECIMATE: filter and decimate a block in place and output the result.
+ * Text format is one "record-number value" line per output sample; binary
+ * formats send a FRAME_TYPE_Q15 frame.
+ * @param buf Start of block in adc_buffer. Overwritten with the output.
+ * @param n Number of samples in block
+ * @param seq Block sequence number
+ * @return None
+ */
+static void output_block_decimated (uint16_t *buf, int n, uint32_t seq)
+{
+	int16_t *out = (int16_t *)buf;
+	uint32_t start = proc_begin();
+	int m, i;
+
+	m = decim_process_dr(&decim, buf, n, out);
+	proc_done(start);
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		for (i = 0; i < m; i++) {
+			print_decimal(decimCount + i);
+			print_byte(' ');
+			print_decimal(out[i]);
+			print_byte('\n');
+		}
+	} else if (m > 0) {
+		FRAME_HEADER_T h;
+		uint8_t *hdr = frame_header_buf();
+
+		h.type = FRAME_TYPE_Q15;
+		h.seq = seq;
+		h.sample_rate = sampleRate / decim_factor(&decim);
+		h.sample_count = m;
+		h.payload_len = 2 * m;
+		h.chan_mask = cfg.chan_mask;
+		frame_begin(&h, hdr);
+		crc_write_bytes((const uint8_t *)out, h.payload_len);
+		frame_end(&h, hdr);
+		if ( ! frame_send(hdr, (const uint8_t *)out, h.payload_len)) {
+			bpShed++;
+		}
+	}
+	decimCount += m;
+}
+
+/**
+ * @brief PROC_GOERTZEL bin frequency.
+ * @param c Configuration
+ * @param i Bin, 0 to c->tone_bins - 1
+ * @return Frequency in Hz, may be negative for a bad configuration
+ */
+static int32_t tone_bin_freq (const CAPTURE_CONFIG_T *c, int i)
+{
+	return (int32_t)c->tone_freq + (2*i - (c->tone_bins - 1)) * (int32_t)c->tone_step / 2;
+}
+
+/**
+ * @brief PROC_GOERTZEL: measure the tone bins over a block and output the
+ * magnitudes. Text format is one "record-number magnitude..." line per block,
+ * record number being the first sample of the block; binary formats send a
+ * FRAME_TYPE_TONES frame.
+ * @param buf Start of block in adc_buffer. Overwritten with the frame payload.
+ * @param n Number of samples in block
+ * @param seq Block sequence number
+ * @return None
+ */
+static void output_block_tones (uint16_t *buf, int n, uint32_t seq)
+{
+	uint32_t mag[GOERTZEL_MAX_BINS];
+	uint32_t start = proc_begin();
+	int i;
+
+	goertzel_block_dr(&goertzel, buf, n, mag);
+	proc_done(start);
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		print_decimal(seq * cfg.block_size);
+		for (i = 0; i < goertzel.nbins; i++) {
+			print_byte(' ');
+			print_decimal(mag[i]);
+		}
+		print_byte('\n');
+	} else {
+		FRAME_HEADER_T h;
+		uint8_t *hdr = frame_header_buf();
+		uint8_t *p = (uint8_t *)buf;
+
+		// The block has been read, reuse it for the payload
+		for (i = 0; i < goertzel.nbins; i++) {
+			frame_put32(p, goertzel.freq[i]);
+			frame_put32(p + 4, mag[i]);
+			p += 8;
+		}
+
+		h.type = FRAME_TYPE_TONES;
+		h.seq = seq;
+		h.sample_rate = sampleRate;
+		h.sample_count = n;
+		h.payload_len = 8 * goertzel.nbins;
+		h.chan_mask = cfg.chan_mask;
+		frame_begin(&h, hdr);
+		crc_write_bytes((const uint8_t *)buf, h.payload_len);
+		frame_end(&h, hdr);
+		if ( ! frame_send(hdr, (const uint8_t *)buf, h.payload_len)) {
+			bpShed++;
+		}
+	}
+}
+
+/**
+ * @brief PROC_FFT: power spectrum of a block, in place, and output it. Text format
+ * is a "# spectrum block-number" line then one "frequency power" line per bin;
+ * binary formats send a FRAME_TYPE_SPECTRUM frame.
+ * @param buf Start of block in adc_buffer. Overwritten with the spectrum.
+ * @param n Number of samples in block
+ * @param seq Block sequence number
+ * @return None
+ */
+static void output_block_spectrum (uint16_t *buf, int n, uint32_t seq)
+{
+	uint32_t start = proc_begin();
+	int k;
+
+	fft_power_dr(buf, n);
+	proc_done(start);
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		print_string("# spectrum ");
+		print_decimal(seq);
+		print_byte('\n');
+		for (k = 0; k < n / 2; k++) {
+			print_decimal(k * sampleRate / n);
+			print_byte(' ');
+			print_decimal(buf[2*k] | ((uint32_t)buf[2*k+1] << 16));
+			print_byte('\n');
+		}
+	} else {
+		FRAME_HEADER_T h;
+		uint8_t *hdr = frame_header_buf();
+
+		h.type = FRAME_TYPE_SPECTRUM;
+		h.seq = seq;
+		h.sample_rate = sampleRate;
+		h.sample_count = n;
+		h.payload_len = 2 * n;
+		h.chan_mask = cfg.chan_mask;
+		frame_begin(&h, hdr);
+		crc_write_bytes((const uint8_t *)buf, h.payload_len);
+		frame_end(&h, hdr);
+		if ( ! frame_send(hdr, (const uint8_t *)buf, h.payload_len)) {
+			bpShed++;
+		}
+	}
+}
+
+/**
+ * @brief PROC_STATS: statistics of each channel of a block, and output them. Text
+ * format is one "record-number channel min max mean rms crossings alarm" line per
+ * channel, record number being the first sample of the block; binary formats
+ * send a FRAME_TYPE_STATS frame. The block is not modified.
+ * @param buf Start of block in adc_buffer
+ * @param n Number of samples in block
+ * @param seq Block sequence number
+ * @return None
+ */
+static void output_block_stats (uint16_t *buf, int n, uint32_t seq)
+{
+	static uint8_t payload[2][FRAME_STATS_LEN * ADC_MAX_CHANNELS];
+	static int payloadIdx = 0;
+	BSTATS_T st[ADC_MAX_CHANNELS];
+	bool alarm[ADC_MAX_CHANNELS];
+	uint32_t start = proc_begin();
+	uint16_t mask;
+	int c;
+
+	for (c = 0; c < numChannels; c++) {
+		bstats_block_dr(&st[c], buf + c, n / numChannels, numChannels);
+		alarm[c] = st[c].min < cfg.alarm_lo || st[c].max > cfg.alarm_hi;
+		if (alarm[c]) {
+			alarmCount++;
+		}
+	}
+	proc_done(start);
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		for (c = 0, mask = cfg.chan_mask; c < numChannels; c++, mask &= mask - 1) {
+			print_decimal(seq * (cfg.block_size / numChannels));
+			print_byte(' ');
+			print_decimal(__builtin_ctz(mask));
+			print_byte(' ');
+			print_decimal(st[c].min);
+			print_byte(' ');
+			print_decimal(st[c].max);
+			print_byte(' ');
+			print_decimal(st[c].sum / st[c].count);
+			print_byte(' ');
+			print_decimal(bstats_ac_rms(&st[c]));
+			print_byte(' ');
+			print_decimal(st[c].crossings);
+			print_byte(' ');
+			print_decimal(alarm[c]);
+			print_byte('\n');
+		}
+	} else {
+		FRAME_HEADER_T h;
+		uint8_t *hdr = frame_header_buf();
+		uint8_t *p;
+
+		// Ping-pong, like the header, as the previous frame may still be sending
+		payloadIdx ^= 1;
+		p = payload[payloadIdx];
+		for (c = 0; c < numChannels; c++) {
+			frame_put16(p, st[c].min);
+			frame_put16(p + 2, st[c].max);
+			frame_put16(p + 4, st[c].crossings);
+			frame_put16(p + 6, alarm[c] ? FRAME_STATS_ALARM : 0);
+			frame_put32(p + 8, st[c].sum);
+			frame_put32(p + 12, st[c].sumsq);
+			frame_put32(p + 16, st[c].sumsq >> 32);
+			p += FRAME_STATS_LEN;
+		}
+
+		h.type = FRAME_TYPE_STATS;
+		h.seq = seq;
+		h.sample_rate = sampleRate;
+		h.sample_count = n;
+		h.payload_len = FRAME_STATS_LEN * numChannels;
+		h.chan_mask = cfg.chan_mask;
+		frame_begin(&h, hdr);
+		crc_write_bytes(payload[payloadIdx], h.payload_len);
+		frame_end(&h, hdr);
+		if ( ! frame_send(hdr, payload[payloadIdx], h.payload_len)) {
+			bpShed++;
+		}
+	}
+}
+
+/**
+ * @brief Default PROC_WINDOW callback: level detector on PIN_DEBUG. The pin goes
+ * high at the first block with a sample at or above cfg.trig_level and low at the
+ * first block entirely below it. On each rising edge the latency is measured from
+ * the ADC trigger of the first sample above the level: the samples after it were
+ * converted one sample period apart, the last one just before timestamp.
+ * @param buf Block of ADC data register values
+ * @param n Number of samples in block
+ * @param timestamp Block completion time
+ * @return None
+ */
+HOT_FUNC(window_level)
+static void window_level (const uint16_t *buf, int n, uint32_t timestamp)
+{
+	// Bits 15:4 of the ADC data register hold the value
+	const uint16_t level = cfg.trig_level << 4;
+	uint32_t lat;
+	int i;
+
+	for (i = 0; i < n && buf[i] < level; i++) {}
+
+	if (i == n) {
+		if (windowHigh) {
+			Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, false);
+			windowHigh = false;
+		}
+		return;
+	}
+	if (windowHigh) {
+		return;
+	}
+	Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, true);
+	windowHigh = true;
+	windowEvents++;
+
+	// Conversion takes 25 ADC clocks (ADC clock = ADC_MAX_SAMPLE_RATE * 25)
+	lat = systick_elapsed(timestamp, systick_now())
+			+ (n - 1 - i) * cfg.match0
+			+ Chip_Clock_GetSystemClockRate() / ADC_MAX_SAMPLE_RATE;
+	windowLatency = lat;
+	if (lat > windowLatencyMax) {
+		windowLatencyMax = lat;
+	}
+}
+
+/**
+ * @brief Output a block of ADC data register values to UART in OUTPUT_FORMAT. Each
+ * sample is read once: the >>4 shift is done as part of the text conversion or
+ * packing, and not at all for OUTPUT_FORMAT_RAW (left to the host). With cfg.proc
+ * set the block is processed instead and the result output.
+ * @param buf Start of block in adc_buffer. Overwritten in OUTPUT_FORMAT_BINARY and
+ * OUTPUT_FORMAT_RICE.
+ * @param n Number of samples in block
+ * @param seq Block sequence number. Blocks are cfg.block_size samples.
+ * @return None
+ */
+static void output_block (uint16_t *buf, int n, uint32_t seq)
+{
+	uint8_t *hdr;
+	int len;
+
+	if (cfg.proc == PROC_DECIMATE) {
+		output_block_decimated(buf, n, seq);
+		return;
+	}
+	if (cfg.proc == PROC_GOERTZEL) {
+		output_block_tones(buf, n, seq);
+		return;
+	}
+	if (cfg.proc == PROC_FFT) {
+		output_block_spectrum(buf, n, seq);
+		return;
+	}
+	if (cfg.proc == PROC_STATS) {
+		output_block_stats(buf, n, seq);
+		return;
+	}
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		output_block_text(buf, n, seq * (cfg.block_size / numChannels));
+		return;
+	}
+
+	hdr = frame_header_buf();
+	len = frame_prepare_samples(
+			sample_frame_type(),
+			buf, n, sampleRate, seq, hdr);
+	if ( ! frame_send(hdr, (uint8_t *)buf, len)) {
+		bpShed++;
+	}
+}
+
+/**
+ * @brief CAPTURE_MODE_ONESHOT: output the whole capture once all blocks are in.
+ * The FFT is block by block, as the capture needn't be a power of 2 samples (3
+ * blocks by default) or fit in FFT_MAX_N. So are sample frames, one per block, as
+ * the whole capture in RAW16 (or worst case Rice) is more than a DMA transport
+ * takes in one frame (UART_DMA_MAX_PAYLOAD). Otherwise the capture is output as
+ * one block. Capture must be stopped.
+ * @return None
+ */
+static void output_oneshot (void)
+{
+	int b;
+
+	if (cfg.proc == PROC_FFT
+			|| (cfg.proc == PROC_NONE && OUTPUT_FORMAT != OUTPUT_FORMAT_TEXT)) {
+		for (b = 0; b < cfg.num_blocks; b++) {
+			output_block(&adc_buffer[b * cfg.block_size], cfg.block_size, b);
+		}
+		return;
+	}
+	output_block(adc_buffer, cfg.block_size * cfg.num_blocks, 0);
+}
+
+/**
+ * @brief Time taken by the DMA to fill one block of cfg.
+ * @return System clock cycles
+ */
+static uint32_t block_cycles (void)
+{
+	return (cfg.block_size / numChannels) * cfg.match0 / (cfg.dual ? 2 : 1);
+}
+
+/**
+ * @brief Polled descriptor ring (cfg.ring_irq != 1): publish the blocks that the
+ * DMA has completed since the last call, in place of DMA_IRQHandler. The ADC
+ * channel's remaining transfer count gives the position in the current block but
+ * not how many times the DMA has moved on to the next block, which is picked to
+ * match the time since the last call. Exact as long as calls are less than 2^24
+ * cycles apart, and cheap when they are less than a block apart.
+ * @return None
+ */
+HOT_FUNC(ring_poll)
+static void ring_poll (void)
+{
+	const uint32_t size = cfg.block_size;
+	uint32_t now, elapsed, pos, blocks;
+
+	// Position and time together
+	__disable_irq();
+	now = systick_now();
+	pos = size - (((LPC_DMA->DMACH[DMA_CH0].XFERCFG >> 16) & 0x3ff) + 1);
+	__enable_irq();
+
+	elapsed = systick_elapsed(ringPollTime, now);
+	if (pos >= ringPollPos && elapsed < ringBlockCycles) {
+		// Same block: a whole block takes longer
+		blocks = 0;
+	} else {
+		// Samples transferred since the last call, then the number of blocks that
+		// brings the DMA from ringPollPos to nearest that
+		uint32_t expect = ringPollPos + size / 2 + (uint64_t)elapsed * numChannels * cfg.frac_len
+				/ ((uint64_t)cfg.match0 * cfg.frac_len + cfg.frac_num);
+		blocks = expect >= pos ? (expect - pos) / size : 0;
+	}
+
+	while (blocks--) {
+		blockq_publish(&blockq, now);
+	}
+	ringPollTime = now;
+	ringPollPos = pos;
+}
+
+/**
+ * @brief Halve the sample rate of a block of ADC data register values in place,
+ * averaging each pair of samples of each channel (BP_DECIMATE).
+ * @param buf Block
+ * @param n Number of samples, a multiple of numChannels
+ * @return Number of samples left: n / 2, rounded down to whole sequences
+ */
+HOT_FUNC(halve_block_dr)
+static int halve_block_dr (uint16_t *buf, int n)
+{
+	const int seqs = n / numChannels / 2;
+	int i, c;
+
+	// Output never gets ahead of input
+	for (i = 0; i < seqs; i++) {
+		const uint16_t *in = &buf[2 * i * numChannels];
+		for (c = 0; c < numChannels; c++) {
+			buf[i * numChannels + c] = (in[c] + in[numChannels + c]) >> 1;
+		}
+	}
+	return seqs * numChannels;
+}
+
+/**
+ * @brief Back-pressure test: can a frame be sent before the DMA starts to
+ * overwrite block blk? That happens when the DMA completes block blk->seq +
+ * num_blocks - 1, and the block being filled now may be about to complete.
+ * @param blk Block, still intact
+ * @param len Payload length in bytes
+ * @param prep Expected time to prepare the frame, in system clock cycles
+ * @return true if the frame would be sent in time
+ */
+static bool bp_fits (const BLOCKQ_ENTRY_T *blk, int len, uint32_t prep)
+{
+	uint32_t left = blk->seq + cfg.num_blocks - blockq.produced;
+	uint32_t budget = left > 1 ? (left - 1) * block_cycles() : 0;
+
+	return transport_drain_cycles() + prep + transport_tx_cycles(FRAME_HEADER_LEN + len) <= budget;
+}
+
+/**
+ * @brief Stream mode output of a block, with back-pressure: a block sent as binary
+ * samples that the link couldn't send before the DMA starts to overwrite it is
+ * decimated, compressed or dropped, following cfg.bp, rather than corrupted while
+ * it's being sent. Like output_block() this waits for the previous frame.
+ * @param blk Block
+ * @return None
+ */
+static void stream_output_block (const BLOCKQ_ENTRY_T *blk)
+{
+	uint16_t *buf = &adc_buffer[blk->index * cfg.block_size];
+	uint8_t type = sample_frame_type();
+	uint32_t rate = sampleRate;
+	int n = cfg.block_size;
+	bool reduced = false;
+	uint8_t *hdr;
+	int len;
+
+	if (cfg.proc == PROC_WINDOW) {
+		uint32_t start = proc_begin();
+		windowFn(buf, n, blk->timestamp);
+		proc_done(start);
+		return;
+	}
+	if (cfg.bp == BP_NONE || cfg.proc != PROC_NONE || OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		output_block(buf, n, blk->seq);
+		return;
+	}
+
+	// Coded length isn't known until the block is coded. Otherwise the last
+	// block's preparation time is the estimate for this one.
+	if (type != FRAME_TYPE_RICE) {
+		len = (type == FRAME_TYPE_RAW16) ? 2*n : frame_packed12_len(n);
+		while ( ! bp_fits(blk, len, procCycles)) {
+			if (cfg.bp == BP_DECIMATE && n >= 2 * numChannels) {
+				n = halve_block_dr(buf, n);
+				rate /= 2;
+				len = (type == FRAME_TYPE_RAW16) ? 2*n : frame_packed12_len(n);
+			} else if (cfg.bp == BP_COMPRESS) {
+				type = FRAME_TYPE_RICE;
+				break;
+			} else {
+				n = 0;
+				break;
+			}
+			reduced = true;
+		}
+		if (type == FRAME_TYPE_RICE) {
+			reduced = true;
+		}
+	}
+
+	if (n > 0) {
+		hdr = frame_header_buf();
+		len = frame_prepare_samples(type, buf, n, rate, blk->seq, hdr);
+		if (type != FRAME_TYPE_RICE || bp_fits(blk, len, 0)) {
+			if (frame_send(hdr, (uint8_t *)buf, len)) {
+				bpReduced += reduced;
+			} else {
+				bpShed++;
+			}
+			return;
+		}
+	}
+
+	// Drop the block. Wait for the previous frame as frame_send() would, so
+	// that the caller can release it.
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+	bpShed++;
+}
+
+// True while the oldest queued block is being sent by DMA. The next block is
+// then processed while it is sent.
+static bool txPending;
+// Overruns already reported
+static uint32_t overrunsReported;
+static uint32_t adcOverrunsReported;
+
+/**
+ * @brief Continuous capture. Output the next block completed by the DMA, while the
+ * DMA fills the next block in the ring.
+ * @return true if there was anything to do
+ */
+static bool stream_poll (void)
+{
+	BLOCKQ_ENTRY_T *blk;
+
+	if (txPending && ! transport_busy()) {
+		blockq_release(&blockq);
+		txPending = false;
+	}
+
+	blk = txPending ? blockq_peek(&blockq, 1) : blockq_front(&blockq);
+	if (blk == NULL) {
+		return false;
+	}
+	INSTR_RECORD(INSTR_HANDOFF, systick_elapsed(blk->timestamp, systick_now()));
+
+	stream_output_block(blk);
+
+	// Polled ring: catch up with the blocks completed meanwhile, so that an
+	// overwritten block is counted when it is released
+	if (cfg.ring_irq != 1) {
+		ring_poll();
+	}
+
+	// stream_output_block() waits for any previous DMA transmit to finish, so
+	// the block that was being sent can now be released.
+	if (txPending) {
+		blockq_release(&blockq);
+	}
+	txPending = transport_busy();
+	if ( ! txPending) {
+		blockq_release(&blockq);
+	}
+
+	// Report lost blocks as a comment line (ignored by GnuPlot). In binary
+	// format lost blocks show up as gaps in the frame sequence numbers.
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT && (blockq.overruns != overrunsReported
+			|| adcOverruns != adcOverrunsReported)) {
+		overrunsReported = blockq.overruns;
+		adcOverrunsReported = adcOverruns;
+		print_string("# overruns ");
+		print_decimal(overrunsReported);
+		print_string(" adc ");
+		print_decimal(adcOverrunsReported);
+		print_byte('\n');
+	}
+	return true;
+}
+
+/**
+ * @brief CAPTURE_MODE_TRIGGER: output the window around the crossing. In text format
+ * a "# trigger" comment line is followed by records numbered from -trig_pre, so
+ * that the crossing is record 0. In binary formats the window is sent as frames
+ * of up to DMA_BUFFER_SIZE samples, all with the window number as seq; the
+ * crossing is sample trig_pre (per channel) of the window.
+ * Capture must be stopped. Binary formats pack the window in place.
+ * @return None
+ */
+static void output_window (void)
+{
+	const uint32_t ring = (uint32_t)cfg.block_size * cfg.num_blocks;
+	const uint32_t chunk_max = DMA_BUFFER_SIZE - DMA_BUFFER_SIZE % numChannels;
+	uint32_t s = trigSample - (uint32_t)cfg.trig_pre * numChannels;
+	uint32_t end = trigSample + (uint32_t)cfg.trig_post * numChannels;
+	int record = -cfg.trig_pre;
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		print_string("# trigger ");
+		print_decimal(trigWindows);
+		print_byte(' ');
+		print_decimal(trigSample / numChannels);
+		print_byte('\n');
+	}
+
+	// The window wraps around the end of the ring at most once
+	while (s < end) {
+		uint16_t *buf = &adc_buffer[s % ring];
+		uint32_t n = end - s;
+
+		if (n > ring - s % ring) {
+			n = ring - s % ring;
+		}
+		if (n > chunk_max) {
+			n = chunk_max;
+		}
+
+		if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+			output_block_text(buf, n, record);
+		} else {
+			uint8_t *hdr = frame_header_buf();
+			int len = frame_prepare_samples(
+					sample_frame_type(),
+					buf, n, sampleRate, trigWindows, hdr);
+			if ( ! frame_send(hdr, (uint8_t *)buf, len)) {
+				bpShed++;
+			}
+		}
+		record += n / numChannels;
+		s += n;
+	}
+	trigWindows++;
+}
+
+/**
+ * @brief Output the sample history to UART in OUTPUT_FORMAT. In binary formats the
+ * history of each channel is sent as FRAME_TYPE_PACKED12 frames of up to
+ * DMA_BUFFER_SIZE samples straight from its ring: it is already packed and
+ * de-interleaved. Frame seq counts frames.
+ * @return None
+ */
+static void output_history (void)
+{
+	uint32_t first = hist_oldest(&hist[0]);
+	uint32_t s;
+	uint32_t seq = 0;
+	uint16_t mask = cfg.chan_mask;
+	int c;
+
+	if (OUTPUT_FORMAT == OUTPUT_FORMAT_TEXT) {
+		// All rings are the same size and hold the same sample numbers
+		for (s = first; s < hist[0].count; s++) {
+			print_decimal(s - first);
+			for (c = 0; c < numChannels; c++) {
+				print_byte(' ');
+				print_decimal(hist_get(&hist[c], s));
+			}
+			print_byte('\n');
+		}
+		return;
+	}
+
+	for (c = 0; c < numChannels; c++) {
+		HIST_T *ring = &hist[c];
+		uint16_t chan = mask & -mask;
+
+		mask &= ~chan;
+		s = first;
+		while (s < ring->count) {
+			FRAME_HEADER_T h;
+			uint8_t *hdr = frame_header_buf();
+			uint32_t n = ring->count - s;
+			const uint8_t *p;
+
+			if (n > DMA_BUFFER_SIZE) {
+				n = DMA_BUFFER_SIZE;
+			}
+			p = hist_span(ring, s, &n);
+
+			h.type = FRAME_TYPE_PACKED12;
+			h.seq = seq++;
+			h.sample_rate = sampleRate;
+			h.sample_count = n;
+			h.payload_len = frame_packed12_len(n);
+			h.chan_mask = chan;
+			frame_begin(&h, hdr);
+			crc_write_bytes(p, h.payload_len);
+			frame_end(&h, hdr);
+			if ( ! frame_send(hdr, p, h.payload_len)) {
+				bpShed++;
+			}
+
+			s += n;
+		}
+	}
+}
+
+/**
+ * @brief History capture. De-interleave and pack staging blocks completed by the
+ * DMA into the history ring of each channel while the DMA fills the next one.
+ * @return true when the history rings are full
+ */
+static bool history_poll (void)
+{
+	BLOCKQ_ENTRY_T *blk;
+	int c;
+
+	while (hist[0].count < hist[0].size && (blk = blockq_front(&blockq)) != NULL) {
+		const uint16_t *buf = &adc_buffer[blk->index * histStageSize];
+
+		for (c = 0; c < numChannels; c++) {
+			hist_write_dr(&hist[c], buf + c, histStageSize / numChannels, numChannels);
+		}
+
+		// A block overwritten while it was being packed is a gap in the history:
+		// start again.
+		if ( ! blockq_release(&blockq)) {
+			for (c = 0; c < numChannels; c++) {
+				hist[c].count = 0;
+				hist[c].wr = 0;
+			}
+		}
+	}
+	return hist[0].count >= hist[0].size;
+}
+
+/**
+ * @brief Average sample rate of a configuration, per channel: the SCT rate, or
+ * twice that for dual sequencer capture.
+ * @param c Configuration
+ * @return Sample rate in mHz
+ */
+static uint32_t capture_rate_x1000 (const CAPTURE_CONFIG_T *c)
+{
+	const uint64_t clk = c->dual ? 2 * Chip_Clock_GetSystemClockRate() : Chip_Clock_GetSystemClockRate();
+	// Period in 1/frac_len system clocks
+	const uint64_t period = (uint64_t)c->match0 * c->frac_len + c->frac_num;
+
+	return (clk * 1000 * c->frac_len + period / 2) / period;
+}
+
+/**
+ * @brief Sample rate of a configuration per channel, rounded to 1Hz. See capture_rate_x1000().
+ * @param c Configuration
+ * @return Sample rate in Hz
+ */
+static uint32_t capture_rate (const CAPTURE_CONFIG_T *c)
+{
+	return (capture_rate_x1000(c) + 500) / 1000;
+}
+
+/**
+ * @brief Set the sample period of a configuration for a sample rate per channel
+ * (of each sequencer in dual sequencer capture): the nearest whole number of
+ * system clocks or, with c->frac, the nearest fraction with a denominator up to
+ * SCT_FRAC_MAX_LEN. SCT_MATCH_2 is set to half the period.
+ * @param c Configuration
+ * @param rate Sample rate in Hz, not 0
+ * @return None
+ */
+static void capture_set_rate (CAPTURE_CONFIG_T *c, uint32_t rate)
+{
+	const uint32_t clk = c->dual ? 2 * Chip_Clock_GetSystemClockRate() : Chip_Clock_GetSystemClockRate();
+	const uint32_t rem = clk % rate;
+	const uint32_t max_len = c->frac ? SCT_FRAC_MAX_LEN : 1;
+	uint32_t len, num, best_len = 1, best_num = (rem + rate/2) / rate;
+	uint64_t err, best_err = (uint64_t)rate * best_num > rem
+			? (uint64_t)rate * best_num - rem : rem - (uint64_t)rate * best_num;
+
+	// The fraction num / len closest to rem / rate: error |num * rate - rem * len| / len
+	for (len = 2; len <= max_len; len++) {
+		num = ((uint64_t)rem * len + rate/2) / rate;
+		err = (uint64_t)num * rate > (uint64_t)rem * len
+				? (uint64_t)num * rate - (uint64_t)rem * len : (uint64_t)rem * len - (uint64_t)num * rate;
+		if (err * best_len < best_err * len) {
+			best_err = err;
+			best_len = len;
+			best_num = num;
+		}
+	}
+
+	c->match0 = clk / rate;
+	if (best_num == best_len) {
+		c->match0++;
+		best_num = 0;
+	}
+	c->frac_num = best_num;
+	c->frac_len = best_num ? best_len : 1;
+	c->match2 = c->match0 / 2;
+}
+
+/**
+ * @brief Check a capture configuration.
+ * @param c Configuration
+ * @return Reason the configuration can't be used, or NULL if it's ok
+ */
+static const char *capture_check (const CAPTURE_CONFIG_T *c)
+{
+	int nchan = frame_channel_count(c->chan_mask);
+
+	if (nchan == 0 || nchan > ADC_MAX_CHANNELS
+			|| (c->chan_mask & ~ADC_CHANNELS_AVAIL) != 0) {
+		return "chan";
+	}
+	// Blocks hold whole sequences, so that every block starts with the lowest channel
+	if (c->block_size % nchan != 0) {
+		return "size";
+	}
+	if (c->block_size < 2 || c->block_size > 1024) {
+		return "size";
+	}
+	if (c->num_blocks < 1 || c->num_blocks > DMA_MAX_BLOCKS
+			|| (c->mode == CAPTURE_MODE_STREAM && c->num_blocks < 2)) {
+		return "blocks";
+	}
+	if ((uint32_t)c->block_size * c->num_blocks > ADC_BUFFER_SIZE) {
+		return "memory";
+	}
+	// Processing is single channel (except statistics), and doesn't apply to
+	// triggered windows or history
+	if (c->proc != PROC_NONE && ((nchan != 1 && c->proc != PROC_STATS)
+			|| c->mode == CAPTURE_MODE_HISTORY || c->mode == CAPTURE_MODE_TRIGGER)) {
+		return "proc";
+	}
+	if (c->decim_r < 2 || c->decim_r > DECIM_MAX_R) {
+		return "decim";
+	}
+	if (c->proc == PROC_WINDOW && c->mode != CAPTURE_MODE_STREAM) {
+		return "proc";
+	}
+	if (c->proc == PROC_FFT && (c->block_size < FFT_MIN_N || c->block_size > FFT_MAX_N
+			|| (c->block_size & (c->block_size - 1)) != 0)) {
+		return "size";
+	}
+	// A polled ring is found to within a sequence or so, see ring_poll()
+	if (c->ring_irq != 1 && (c->mode != CAPTURE_MODE_STREAM || c->dual
+			|| c->block_size < 4 * nchan || (c->ring_irq > 1 && c->num_blocks % c->ring_irq != 0))) {
+		return "irq";
+	}
+	if (c->dual && (nchan != 1 || c->block_size % 2 != 0
+			|| (c->mode != CAPTURE_MODE_ONESHOT && c->mode != CAPTURE_MODE_STREAM))) {
+		return "dual";
+	}
+	if (c->proc == PROC_GOERTZEL) {
+		uint32_t rate = capture_rate(c);
+		int i;
+
+		if (c->tone_bins < 1 || c->tone_bins > GOERTZEL_MAX_BINS) {
+			return "tones";
+		}
+		// Below rate / 256 s can overflow and Q14 coefficients get too coarse
+		for (i = 0; i < c->tone_bins; i++) {
+			int32_t f = tone_bin_freq(c, i);
+			if (f <= 0 || (uint32_t)f * 256 < rate || (uint32_t)f * 2 >= rate) {
+				return "tones";
+			}
+		}
+	}
+	if (c->mode == CAPTURE_MODE_TRIGGER
+			&& (c->num_blocks < 3 || c->trig_post == 0 || c->trig_level > 4095
+			|| (uint32_t)(c->trig_pre + c->trig_post) * nchan
+				> (uint32_t)(c->num_blocks - 2) * c->block_size)) {
+		return "window";
+	}
+	// Conversion takes 25 ADC clocks, max 1.2Msps for all channels together: a
+	// trigger converts every channel of the sequence one after another. Dual
+	// sequencer capture may go up to twice that, see DUAL_SEQ.
+	if (c->match0 < nchan * (Chip_Clock_GetSystemClockRate() / ADC_MAX_SAMPLE_RATE)
+			|| c->match2 == 0 || c->match2 >= c->match0
+			|| c->frac_len < 1 || c->frac_len > SCT_FRAC_MAX_LEN || c->frac_num >= c->frac_len) {
+		return "match";
+	}
+	return NULL;
+}
+
+/**
+ * @brief Fractional sample period: fill sctPeriods with cfg's pattern of
+ * frac_len periods, frac_num of them one clock longer, and start SCT_FRAC_DMA_CH
+ * writing them to the SCT_MATCH_0 reload register in a loop. The SCT must be
+ * halted.
+ * @return None
+ */
+static void sct_frac_start (void)
+{
+	uint32_t acc = 0;
+	int i;
+
+	// Phase accumulator: a longer period each time the fraction wraps
+	for (i = 0; i < cfg.frac_len; i++) {
+		acc += cfg.frac_num;
+		if (acc >= cfg.frac_len) {
+			acc -= cfg.frac_len;
+			sctPeriods[i] = cfg.match0;
+		} else {
+			sctPeriods[i] = cfg.match0 - 1;
+		}
+	}
+
+	// At the end of each period the SCT reloads SCT_MATCH_0 and event 0 requests
+	// the DMA, which writes the reload value for the period after next. So the
+	// last two periods of the pattern are loaded here and the DMA starts from the
+	// first. frac_len is at least 2.
+	Chip_SCT_SetMatchCount(LPC_SCT, SCT_MATCH_0, sctPeriods[cfg.frac_len - 2]);
+	Chip_SCT_SetMatchReload(LPC_SCT, SCT_MATCH_0, sctPeriods[cfg.frac_len - 1]);
+
+	// Addresses are END addresses. The descriptor reloads itself.
+	sctFracDesc.xfercfg = DMA_XFERCFG_CFGVALID
+			| DMA_XFERCFG_RELOAD
+			| DMA_XFERCFG_WIDTH_32
+			| DMA_XFERCFG_SRCINC_1
+			| DMA_XFERCFG_DSTINC_0
+			| DMA_XFERCFG_XFERCOUNT(cfg.frac_len);
+	sctFracDesc.source = DMA_ADDR(&sctPeriods[cfg.frac_len - 1]);
+	sctFracDesc.dest = DMA_ADDR(&LPC_SCT->MATCHREL[SCT_MATCH_0].U);
+	sctFracDesc.next = DMA_ADDR(&sctFracDesc);
+
+	Chip_DMA_EnableChannel(LPC_DMA, SCT_FRAC_DMA_CH);
+	Chip_DMA_SetupTranChannel(LPC_DMA, SCT_FRAC_DMA_CH, &sctFracDesc);
+	Chip_DMA_SetValidChannel(LPC_DMA, SCT_FRAC_DMA_CH);
+	Chip_DMA_SetupChannelTransfer(LPC_DMA, SCT_FRAC_DMA_CH, sctFracDesc.xfercfg);
+
+	// SCT DMA request 0 on event 0 (end of period)
+	LPC_SCT->DMA0REQUEST = 1 << 0;
+}
+
+/**
+ * @brief Stop capture: halt the SCT so there are no more ADC triggers, then stop
+ * the ADC DMA channel. Waits for any frame being sent by DMA from adc_buffer
+ * first. The ADC stays powered so that capture can be restarted quickly.
+ * @return None
+ */
+static void capture_stop (void)
+{
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+
+	Chip_SCT_SetControl(LPC_SCT, SCT_CTRL_HALT_L);
+	LPC_SCT->DMA0REQUEST = 0;
+	Chip_ADC_DisableSequencer(LPC_ADC, ADC_SEQA_IDX);
+	Chip_ADC_DisableSequencer(LPC_ADC, ADC_SEQB_IDX);
+	trigger_disarm();
+
+	// Abort sequence, UM10800 §12.6.3
+	Chip_DMA_DisableChannel(LPC_DMA, DMA_CH0);
+	Chip_DMA_DisableChannel(LPC_DMA, DUAL_DMA_CH);
+	Chip_DMA_DisableChannel(LPC_DMA, SCT_FRAC_DMA_CH);
+	while (Chip_DMA_GetBusyChannels(LPC_DMA)
+			& ((1 << DMA_CH0) | (1 << DUAL_DMA_CH) | (1 << SCT_FRAC_DMA_CH))) {}
+	Chip_DMA_AbortChannel(LPC_DMA, DMA_CH0);
+	Chip_DMA_AbortChannel(LPC_DMA, DUAL_DMA_CH);
+	Chip_DMA_AbortChannel(LPC_DMA, SCT_FRAC_DMA_CH);
+	Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DMA_CH0);
+	Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DUAL_DMA_CH);
+
+	captureRunning = false;
+}
+
+/**
+ * @brief Start capture with cfg: rebuild the DMA descriptor chain, set the ADC
+ * channel and the SCT sample timing. Capture must be stopped. Waits for any
+ * frame being sent by DMA from adc_buffer first.
+ * @return None
+ */
+static void capture_start (void)
+{
+	volatile uint32_t *src;
+	uint32_t seq_ctrl, match2;
+	int i;
+
+	// adc_buffer is about to be overwritten
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+
+	numChannels = frame_channel_count(cfg.chan_mask);
+	if (cfg.dual) {
+		// Both sequencers convert the same channel: DMA from their own global
+		// data registers, the channel data register is shared.
+		src = &LPC_ADC->SEQ_GDAT[ADC_SEQA_IDX];
+		seq_ctrl = ADC_SEQ_CTRL_MODE_EOS;
+	} else if (numChannels == 1) {
+		// One conversion per trigger. DMA when the sequence is complete, from
+		// the channel data register.
+		src = &LPC_ADC->DR[__builtin_ctz(cfg.chan_mask)];
+		seq_ctrl = ADC_SEQ_CTRL_MODE_EOS;
+	} else {
+		// Each trigger converts every channel of the sequence, in ascending
+		// channel order. End of conversion mode: DMA after each conversion, from
+		// the sequence global data register, so that the samples are stored
+		// interleaved. 16 bit transfers keep the result (bits 15:4) but not the
+		// channel number (bits 29:26): the order of the samples identifies
+		// the channel.
+		src = &LPC_ADC->SEQ_GDAT[ADC_SEQA_IDX];
+		seq_ctrl = 0;
+	}
+
+	if (cfg.mode == CAPTURE_MODE_HISTORY) {
+		// Staging ring at the start of adc_buffer, packed history rings in the rest
+		const int stage_len = HIST_STAGE_SIZE * HIST_STAGE_BLOCKS;
+		uint8_t *p = (uint8_t *)&adc_buffer[stage_len];
+		uint32_t len = sizeof(adc_buffer) - stage_len * sizeof(adc_buffer[0]);
+
+		histStageSize = HIST_STAGE_SIZE - HIST_STAGE_SIZE % (2 * numChannels);
+		dma_setup_descriptors(dmaDesc, src, adc_buffer, histStageSize, HIST_STAGE_BLOCKS, 1, true, 1);
+		blockq_init(&blockq, HIST_STAGE_BLOCKS);
+		len /= numChannels;
+		for (i = 0; i < numChannels; i++) {
+			hist_init(&hist[i], p + i * len, len);
+		}
+	} else {
+		// DMA is performed in separate chunks (as max allowed in one transfer
+		// is 1024 words). In streaming and trigger modes the chain is a ring.
+		const bool ring = cfg.mode == CAPTURE_MODE_STREAM || cfg.mode == CAPTURE_MODE_TRIGGER;
+
+		if (cfg.dual) {
+			// SEQB samples first, into the even samples of each block
+			dma_setup_descriptors(dmaDescB, &LPC_ADC->SEQ_GDAT[ADC_SEQB_IDX], adc_buffer,
+					cfg.block_size, cfg.num_blocks, 2, ring, 1);
+			dma_setup_descriptors(dmaDesc, src, adc_buffer + 1, cfg.block_size, cfg.num_blocks, 2, ring, 1);
+		} else {
+			dma_setup_descriptors(dmaDesc, src, adc_buffer, cfg.block_size, cfg.num_blocks, 1, ring,
+					cfg.ring_irq);
+		}
+		blockq_init(&blockq, cfg.num_blocks);
+	}
+	txPending = false;
+	overrunsReported = 0;
+	adcOverrunsReported = 0;
+	adcOverruns = 0;
+	dualBlocks = 0;
+	dualSlips = 0;
+	ringPollPos = 0;
+	// A block's first and last sequences are one period less than a block apart
+	ringBlockCycles = block_cycles() - cfg.match0;
+	ringWakes = 0;
+
+	decim_init(&decim, cfg.decim_r);
+	decimCount = 0;
+	procCycles = 0;
+	alarmCount = 0;
+	windowHigh = false;
+	windowEvents = 0;
+	windowLatency = 0;
+	windowLatencyMax = 0;
+	Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, false);
+	bpShed = 0;
+	bpReduced = 0;
+
+	// Trigger is armed by DMA_IRQHandler once there are trig_pre samples
+	trigger_disarm();
+	trigFired = false;
+	trigWindowReady = false;
+	Chip_ADC_SetThrLowValue(LPC_ADC, 0, cfg.trig_level);
+	Chip_ADC_SelectTH0Channels(LPC_ADC, cfg.chan_mask);
+
+	// Setup a sequencer A to do the following: (ref UM10800, 21.6.2, Table (undefined).)
+	// * Do conversions on the selected channels only
+	// * Trigger sampling on SCT0_OUT3  See UM10800 §21.3.3, Table 276.
+	// Note, as far as I can tell, ADC_SEQ_CTRL_HWTRIG_* defines are incorrect for LPC824.
+	// * Mode END_OF_SEQ (one channel) : trigger DMA/interrupt when sequence is complete.
+	Chip_ADC_SetupSequencer(LPC_ADC,
+							ADC_SEQA_IDX,
+							(cfg.chan_mask
+							//| ADC_SEQ_CTRL_HWTRIG_SCT_OUT1
+							| (3<<12) // trig on SCT0_OUT3.
+							| seq_ctrl
+							// Dual: SEQA on the rising edge, SEQB on the falling edge
+							| (cfg.dual ? ADC_SEQ_CTRL_HWTRIGPOL : 0)
+							)
+									);
+	if (cfg.dual) {
+		Chip_ADC_SetupSequencer(LPC_ADC, ADC_SEQB_IDX, cfg.chan_mask | (3<<12) | seq_ctrl);
+	}
+
+	// Enable fixed pins for the channels with SwitchMatrix. Cannot move ADC pins.
+	Chip_Clock_EnablePeriphClock(SYSCTL_CLOCK_SWM);
+	for (i = 0; i < 12; i++) {
+		if ( ! (ADC_CHANNELS_AVAIL & (1 << i))) {
+			continue;
+		}
+		if (cfg.chan_mask & (1 << i)) {
+			Chip_SWM_EnableFixedPin(adcFixedPin[i]);
+		} else {
+			Chip_SWM_DisableFixedPin(adcFixedPin[i]);
+		}
+	}
+	Chip_Clock_DisablePeriphClock(SYSCTL_CLOCK_SWM);
+
+	/* Clear all pending interrupts */
+	Chip_ADC_ClearFlags(LPC_ADC, Chip_ADC_GetFlags(LPC_ADC));
+	NVIC_ClearPendingIRQ(ADC_OVR_IRQn);
+
+	// Overrun detection, single channel and sequencer only (see ADC_OVR_IRQHandler)
+	if (numChannels == 1 && ! cfg.dual) {
+		Chip_ADC_EnableInt(LPC_ADC, ADC_INTEN_OVRRUN_ENABLE);
+	} else {
+		Chip_ADC_DisableInt(LPC_ADC, ADC_INTEN_OVRRUN_ENABLE);
+	}
+
+	/* Enable sequencer */
+	Chip_ADC_EnableSequencer(LPC_ADC, ADC_SEQA_IDX);
+	if (cfg.dual) {
+		Chip_ADC_EnableSequencer(LPC_ADC, ADC_SEQB_IDX);
+		Chip_DMA_EnableChannel(LPC_DMA, DUAL_DMA_CH);
+		Chip_DMA_SetupTranChannel(LPC_DMA, DUAL_DMA_CH, &dmaDescB[0]);
+		Chip_DMA_SetValidChannel(LPC_DMA, DUAL_DMA_CH);
+		Chip_DMA_SetupChannelTransfer(LPC_DMA, DUAL_DMA_CH, dmaDescB[0].xfercfg);
+	}
+
+	/* Setup transfer descriptor and validate it */
+	Chip_DMA_EnableChannel(LPC_DMA, DMA_CH0);
+	Chip_DMA_SetupTranChannel(LPC_DMA, DMA_CH0, &dmaDesc[0]);
+	Chip_DMA_SetValidChannel(LPC_DMA, DMA_CH0);
+
+	// Setup data transfer and hardware trigger
+	// See "Transfer Configuration registers" UM10800, §12.6.18, Table 173, page 179
+	Chip_DMA_SetupChannelTransfer(LPC_DMA, DMA_CH0, dmaDesc[0].xfercfg);
+
+	// Setup SCT for ADC/DMA sample timing. Counter restarts from 0 so the first
+	// sample is one full period after start. Dual sequencer capture needs the
+	// SCT0_OUT3 edges half a period apart, whatever cfg.match2. The counter
+	// counts 0 to SCT_MATCH_0, so SCT_MATCH_0 is the period less one.
+	match2 = cfg.dual ? cfg.match0 / 2 : cfg.match2;
+	Chip_SCT_SetMatchReload(LPC_SCT, SCT_MATCH_2, match2);
+	Chip_SCT_SetMatchCount(LPC_SCT, SCT_MATCH_2, match2);
+	if (cfg.frac_num != 0) {
+		sct_frac_start();
+	} else {
+		Chip_SCT_SetMatchReload(LPC_SCT, SCT_MATCH_0, cfg.match0 - 1);
+		Chip_SCT_SetMatchCount(LPC_SCT, SCT_MATCH_0, cfg.match0 - 1);
+	}
+	LPC_SCT->COUNT_U = 0;
+	if (cfg.dual) {
+		// Start with SCT0_OUT3 high so that the first edge, at SCT_MATCH_2, is
+		// the falling one: SEQB samples first.
+		LPC_SCT->OUTPUT |= 1 << 3;
+	}
+	sampleRate = capture_rate(&cfg);
+
+	if (cfg.proc == PROC_GOERTZEL) {
+		uint32_t freq[GOERTZEL_MAX_BINS];
+		for (i = 0; i < cfg.tone_bins; i++) {
+			freq[i] = tone_bin_freq(&cfg, i);
+		}
+		goertzel_init(&goertzel, freq, cfg.tone_bins, sampleRate);
+	}
+
+	captureRunning = true;
+
+	// Start SCT
+	ringPollTime = systick_now();
+	Chip_SCT_ClearControl(LPC_SCT, SCT_CTRL_HALT_L | SCT_CTRL_HALT_H);
+}
+
+/**
+ * @brief Check and apply a new capture configuration. If capture is running it is
+ * restarted with the new configuration, and the restart time is measured.
+ * @param c Configuration
+ * @return true if the configuration is used. Sends the reply.
+ */
+static bool capture_configure (const CAPTURE_CONFIG_T *c)
+{
+	const char *err = capture_check(c);
+	uint32_t start;
+
+	if (err) {
+		cmd_reply_begin(false);
+		cmd_reply_word(err);
+		cmd_reply_end();
+		return false;
+	}
+
+	if (captureRunning) {
+		// Don't count waiting for a frame to be sent
+		while (transport_busy()) {
+			INSTR_SLEEP();
+		}
+		start = systick_now();
+		capture_stop();
+		cfg = *c;
+		capture_start();
+		restartCycles = systick_elapsed(start, systick_now());
+	} else {
+		cfg = *c;
+	}
 
+	cmd_reply_begin(true);
+	cmd_reply_field("rate", capture_rate(&cfg));
+	cmd_reply_field("rate_x1000", capture_rate_x1000(&cfg));
+	if (captureRunning) {
+		cmd_reply_field("restart_us",
+				restartCycles / (Chip_Clock_GetSystemClockRate() / 1000000));
+	}
+	cmd_reply_end();
+	return true;
+}
 
-#define DMA_BUFFER_SIZE 1024
+/**
+ * @brief Parse the single unsigned argument of a command.
+ * @return false if missing or not a number (the reply has been sent)
+ */
+static bool cmd_arg (int argc, char *argv[], int i, uint32_t *v)
+{
+	if (argc <= i || ! cmd_parse_uint(argv[i], v)) {
+		cmd_reply_begin(false);
+		cmd_reply_word("arg");
+		cmd_reply_end();
+		return false;
+	}
+	return true;
+}
 
-static DMA_CHDESC_T dmaDescA;
-static DMA_CHDESC_T dmaDescB;
-static DMA_CHDESC_T dmaDescC;
+// rate <Hz> : sample rate. Sets the nearest period (of each sequencer in dual
+// sequencer capture, fractional if "clock frac"), SCT_MATCH_2 to half.
+static void cmd_rate (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t rate;
 
-// This is where we put ADC results
-static uint16_t adc_buffer[DMA_BUFFER_SIZE*3];
+	if ( ! cmd_arg(argc, argv, 1, &rate)) {
+		return;
+	}
+	if (rate == 0) {
+		cmd_reply_begin(false);
+		cmd_reply_word("arg");
+		cmd_reply_end();
+		return;
+	}
+	capture_set_rate(&c, rate);
+	capture_configure(&c);
+}
+
+// match <m0> [<m2>] : whole sample period and SCT_MATCH_2 in system clocks
+static void cmd_match (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+
+	if ( ! cmd_arg(argc, argv, 1, &c.match0)) {
+		return;
+	}
+	c.frac_num = 0;
+	c.frac_len = 1;
+	c.match2 = c.match0 / 2;
+	if (argc > 2 && ! cmd_arg(argc, argv, 2, &c.match2)) {
+		return;
+	}
+	capture_configure(&c);
+}
+
+// chan <mask> : ADC_SEQ_CTRL_CHANSEL mask, eg chan 0x208 for ADC3 and ADC9
+static void cmd_chan (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t v;
+
+	if ( ! cmd_arg(argc, argv, 1, &v)) {
+		return;
+	}
+	c.chan_mask = v > 0xffff ? 0 : v;
+	capture_configure(&c);
+}
+
+// blocks <n> : number of chained descriptors
+static void cmd_blocks (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t v;
+
+	if ( ! cmd_arg(argc, argv, 1, &v)) {
+		return;
+	}
+	c.num_blocks = v > DMA_MAX_BLOCKS ? 0 : v;
+	capture_configure(&c);
+}
+
+// size <n> : DMA transfer count (samples per block)
+static void cmd_size (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t v;
+
+	if ( ! cmd_arg(argc, argv, 1, &v)) {
+		return;
+	}
+	c.block_size = v > 1024 ? 0 : v;
+	capture_configure(&c);
+}
+
+// mode oneshot|stream|history|trigger : capture mode
+static void cmd_mode (int argc, char *argv[])
+{
+	static const char * const modes[] = {"oneshot", "stream", "history", "trigger"};
+	CAPTURE_CONFIG_T c = cfg;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(modes)/sizeof(modes[0]); i++) {
+		if (argc > 1 && strcmp(argv[1], modes[i]) == 0) {
+			c.mode = i;
+			capture_configure(&c);
+			return;
+		}
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
+
+// policy <none|drop|decimate|compress> : stream mode back-pressure, see BP_*
+static void cmd_policy (int argc, char *argv[])
+{
+	static const char * const policies[] = {"none", "drop", "decimate", "compress"};
+	CAPTURE_CONFIG_T c = cfg;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(policies)/sizeof(policies[0]); i++) {
+		if (argc > 1 && strcmp(argv[1], policies[i]) == 0) {
+			c.bp = i;
+			capture_configure(&c);
+			return;
+		}
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
+
+// seq <single|dual> : one ADC sequencer, or both (see DUAL_SEQ). The rate is kept.
+static void cmd_seq (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t rate = capture_rate(&cfg);
+
+	if (argc > 1 && (strcmp(argv[1], "single") == 0 || strcmp(argv[1], "dual") == 0)) {
+		c.dual = strcmp(argv[1], "dual") == 0;
+		capture_set_rate(&c, rate);
+		capture_configure(&c);
+		return;
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
+
+// irq <n> : stream mode block interrupts, every block (1), every nth block (n > 1)
+// or none (0). See RING_IRQ.
+static void cmd_irq (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t v;
+
+	if ( ! cmd_arg(argc, argv, 1, &v)) {
+		return;
+	}
+	c.ring_irq = v > DMA_MAX_BLOCKS ? DMA_MAX_BLOCKS + 1 : v;
+	capture_configure(&c);
+}
+
+// clock <int|frac> : whole or fractional sample period (see SCT_FRACTIONAL). The
+// rate is kept.
+static void cmd_clock (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t rate = capture_rate(&cfg);
+
+	if (argc > 1 && (strcmp(argv[1], "int") == 0 || strcmp(argv[1], "frac") == 0)) {
+		c.frac = strcmp(argv[1], "frac") == 0;
+		capture_set_rate(&c, rate);
+		capture_configure(&c);
+		return;
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
+
+// trig <level> [<pre> <post>] : CAPTURE_MODE_TRIGGER threshold and window
+static void cmd_trig (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t level, pre = cfg.trig_pre, post = cfg.trig_post;
+
+	if ( ! cmd_arg(argc, argv, 1, &level)) {
+		return;
+	}
+	if (argc > 2 && ( ! cmd_arg(argc, argv, 2, &pre) || ! cmd_arg(argc, argv, 3, &post))) {
+		return;
+	}
+	c.trig_level = level > 0xffff ? 0xffff : level;
+	c.trig_pre = pre > 0xffff ? 0xffff : pre;
+	c.trig_post = post > 0xffff ? 0xffff : post;
+	capture_configure(&c);
+}
+
+// proc none|decimate|goertzel|fft|stats : block processing
+static void cmd_proc (int argc, char *argv[])
+{
+	static const char * const procs[] = {"none", "decimate", "goertzel", "fft", "stats", "window"};
+	CAPTURE_CONFIG_T c = cfg;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(procs)/sizeof(procs[0]); i++) {
+		if (argc > 1 && strcmp(argv[1], procs[i]) == 0) {
+			c.proc = i;
+			capture_configure(&c);
+			return;
+		}
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
+
+// decim <r> : PROC_DECIMATE CIC rate change, output rate is rate / (2 * r)
+static void cmd_decim (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t v;
+
+	if ( ! cmd_arg(argc, argv, 1, &v)) {
+		return;
+	}
+	c.decim_r = v > DECIM_MAX_R ? 0 : v;
+	capture_configure(&c);
+}
 
-static volatile int dmaBlockCount = 0;
+// tones <freq> [<step> <bins>] : PROC_GOERTZEL bins, <bins> bins <step> Hz apart
+// centred on <freq> Hz
+static void cmd_tones (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t freq, step = cfg.tone_step, bins = cfg.tone_bins;
+
+	if ( ! cmd_arg(argc, argv, 1, &freq)) {
+		return;
+	}
+	if (argc > 2 && ( ! cmd_arg(argc, argv, 2, &step) || ! cmd_arg(argc, argv, 3, &bins))) {
+		return;
+	}
+	c.tone_freq = freq;
+	c.tone_step = step > 0xffff ? 0xffff : step;
+	c.tone_bins = bins > GOERTZEL_MAX_BINS ? 0 : bins;
+	capture_configure(&c);
+}
+
+// alarm <lo> <hi> : PROC_STATS alarm limits
+static void cmd_alarm (int argc, char *argv[])
+{
+	CAPTURE_CONFIG_T c = cfg;
+	uint32_t lo, hi;
+
+	if ( ! cmd_arg(argc, argv, 1, &lo) || ! cmd_arg(argc, argv, 2, &hi)) {
+		return;
+	}
+	c.alarm_lo = lo > 0xffff ? 0xffff : lo;
+	c.alarm_hi = hi > 0xffff ? 0xffff : hi;
+	capture_configure(&c);
+}
+
+#if INSTR_ENABLE
+// instr [reset] : instrumentation stats (see instr.h). For each stage its name
+// then count, min, max and average in system clock cycles, then the active duty
+// cycle.
+static void cmd_instr (int argc, char *argv[])
+{
+	int i;
 
+	if (argc > 1) {
+		if (strcmp(argv[1], "reset") != 0) {
+			cmd_reply_begin(false);
+			cmd_reply_word("arg");
+			cmd_reply_end();
+			return;
+		}
+		instr_reset();
+	}
+
+	cmd_reply_begin(true);
+	for (i = 0; i < INSTR_NUM_STAGES; i++) {
+		INSTR_STAGE_T st = instrStage[i];
+
+		cmd_reply_word(instr_name(i));
+		cmd_reply_field("n", st.count);
+		cmd_reply_field("min", st.min);
+		cmd_reply_field("max", st.max);
+		cmd_reply_field("avg", st.count ? (uint32_t)(st.total / st.count) : 0);
+	}
+	cmd_reply_word("duty");
+	cmd_reply_field("permille", instr_duty_permille());
+	cmd_reply_end();
+}
+#endif
+
+#if MTB_TRACE
+// mtb : send the MTB trace since the last "mtb" (or reset) as a FRAME_TYPE_TRACE
+// frame, then start a new one. Replies with the number of packets and whether the
+// buffer filled up, or "# err link" if the link refused the frame. host/mtb_decode.c
+// turns the frames into instruction counts.
+static void cmd_mtb (int argc, char *argv[])
+{
+	static uint32_t traceSeq = 0;
+	FRAME_HEADER_T h;
+	const uint8_t *trace;
+	uint8_t *hdr = frame_header_buf();
+	bool full, sent;
+	int n;
+
+	n = mtb_trace_get(&trace, &full);
+	h.type = FRAME_TYPE_TRACE;
+	h.seq = traceSeq++;
+	h.sample_rate = sampleRate;
+	h.sample_count = n;
+	h.payload_len = n * MTB_PACKET_LEN;
+	h.chan_mask = cfg.chan_mask;
+	frame_begin(&h, hdr);
+	crc_write_bytes(trace, h.payload_len);
+	frame_end(&h, hdr);
+	sent = frame_send(hdr, trace, h.payload_len);
+
+	// The frame is sent from the trace buffer
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+	mtb_trace_arm();
+
+	// Refused by the link: the trace is lost
+	if ( ! sent) {
+		cmd_reply_begin(false);
+		cmd_reply_word("link");
+		cmd_reply_end();
+		return;
+	}
+	cmd_reply_begin(true);
+	cmd_reply_field("packets", n);
+	cmd_reply_field("full", full);
+	cmd_reply_end();
+}
+#endif
+
+// Benchmark kernels
+#define BENCH_RAW 0			// Hand-off only
+#define BENCH_SHIFT 1		// >>4 of every sample
+#define BENCH_STATS 2		// bstats_block_dr()
+#define BENCH_DECIMATE 3	// decim_process_dr()
+#define BENCH_FFT 4			// fft_power_dr()
+#define BENCH_COMPRESS 5	// rice_encode_dr()
+#define BENCH_TEXT_DIV 6	// Text lines with fmt_decimal_div(), not sent
+#define BENCH_TEXT 7		// Text lines with fmt_decimal(), not sent
+#define BENCH_NUM 8
+
+static const char * const benchNames[BENCH_NUM] = {
+	"raw", "shift", "stats", "decimate", "fft", "compress", "text_div", "text"
+};
 
 /**
- * @brief Pulse debugging pin to indicate an event on a oscilloscope trace.
- * @param n Number of times to pulse the pin.
- * @return None
+ * @brief BENCH_TEXT_DIV / BENCH_TEXT: format a block as output_block_text() does,
+ * without sending it.
+ * @param fmt fmt_decimal or fmt_decimal_div
+ * @param buf Block
+ * @param n Number of samples
+ * @return Number of chars formatted
  */
-static void debug_pin_pulse (int n)
+static uint32_t bench_text (int (*fmt)(char *, int), const uint16_t *buf, int n)
 {
-	int i;
+	char line[UART_DEC_MAX + 5 + 1];
+	uint32_t total = 0;
+	int i, len;
+
 	for (i = 0; i < n; i++) {
-		Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, true);
-		Chip_GPIO_SetPinState(LPC_GPIO_PORT, 0, PIN_DEBUG, false);
+		len = fmt(line, i);
+		line[len++] = ' ';
+		len += fmt(&line[len], buf[i] >> 4);
+		line[len++] = '\n';
+		total += len;
 	}
+	return total;
 }
 
 /**
- * @brief Send one byte to UART. Block if UART busy.
- * @param n Byte to send to UART.
- * @return None.
+ * @brief Run a benchmark kernel over a block. The block is overwritten.
+ * @param kernel BENCH_*
+ * @param buf Block
+ * @param n Number of samples
+ * @return None
  */
-static void print_byte (uint8_t n) {
-	//Chip_UART_SendBlocking(LPC_USART0, &n, 1);
-
-	// Wait until data can be written to FIFO (TXRDY==1)
-	while ( (Chip_UART_GetStatus(LPC_USART0) & UART_STAT_TXRDY) == 0) {}
+static void bench_process (int kernel, uint16_t *buf, int n)
+{
+	BSTATS_T st;
+	uint32_t sum = 0;
+	int i;
 
-	Chip_UART_SendByte(LPC_USART0, n);
+	switch (kernel) {
+	case BENCH_SHIFT:
+		for (i = 0; i < n; i++) {
+			sum += buf[i] >> 4;
+		}
+		// Keep the result so that the loop isn't optimised away
+		buf[0] = sum;
+		break;
+	case BENCH_STATS:
+		bstats_block_dr(&st, buf, n, 1);
+		break;
+	case BENCH_DECIMATE:
+		decim_process_dr(&decim, buf, n, (int16_t *)buf);
+		break;
+	case BENCH_FFT:
+		fft_power_dr(buf, n);
+		break;
+	case BENCH_COMPRESS:
+		rice_encode_dr(buf, n, 1);
+		break;
+	case BENCH_TEXT_DIV:
+		buf[0] = bench_text(fmt_decimal_div, buf, n);
+		break;
+	case BENCH_TEXT:
+		buf[0] = bench_text(fmt_decimal, buf, n);
+		break;
+	default:
+		break;
+	}
 }
 
 /**
- * @brief Print a signed integer in decimal radix.
- * @param n Number to print.
- * @return None.
+ * @brief Run one benchmark step: stream BENCH_BLOCKS blocks at a sample rate,
+ * processing each with a kernel as soon as it is complete.
+ * @param kernel BENCH_*
+ * @param rate Sample rate in Hz
+ * @param cycles Longest block processing time in system clocks
+ * @return NULL if the rate is sustained, else why not: "lost", "adc", "slip" (dual
+ * sequencer capture) or "lag"
  */
-static void print_decimal (int n) {
-	char buf[10];
-	int i = 0;
+static const char *bench_step (int kernel, uint32_t rate, uint32_t *cycles)
+{
+	bool lag = false;
+
+	cfg.mode = CAPTURE_MODE_STREAM;
+	capture_set_rate(&cfg, rate);
+	capture_start();
+
+	*cycles = 0;
+	while (blockq.produced < BENCH_BLOCKS && blockq.overruns == 0 && blockq.dropped == 0) {
+		BLOCKQ_ENTRY_T *blk = blockq_front(&blockq);
+		uint32_t start, t;
+
+		if (blk == NULL) {
+			INSTR_SLEEP();
+			continue;
+		}
+		if (blockq_pending(&blockq) >= (uint32_t)cfg.num_blocks - 1) {
+			lag = true;
+		}
+		start = systick_now();
+		bench_process(kernel, &adc_buffer[blk->index * cfg.block_size], cfg.block_size);
+		t = systick_elapsed(start, systick_now());
+		if (t > *cycles) {
+			*cycles = t;
+		}
+		blockq_release(&blockq);
+	}
+	capture_stop();
 
-	// Special case of n==0
-	if (n == 0) {
-		print_byte('0');
-		return;
+	if (blockq.overruns != 0 || blockq.dropped != 0) {
+		return "lost";
+	}
+	if (adcOverruns != 0) {
+		return "adc";
 	}
+	if (dualSlips != 0) {
+		return "slip";
+	}
+	return lag ? "lag" : NULL;
+}
 
-	// Handle negative numbers
-	if (n < 0) {
-		print_byte('-');
-		n = -n;
+/**
+ * @brief Benchmark all kernels and print a table of "# bench" comment lines: kernel,
+ * highest sustained rate, first failing rate (0 if none) and why, longest block
+ * processing time at the highest sustained rate and that as a percentage of the
+ * block time. The configuration is restored afterwards.
+ * @return None
+ */
+static void bench_run (void)
+{
+	// Dual sequencer capture is benchmarked up to twice the ADC rating
+	const uint32_t max_rate = cfg.dual ? 2 * ADC_MAX_SAMPLE_RATE : ADC_MAX_SAMPLE_RATE;
+	const CAPTURE_CONFIG_T saved = cfg;
+	const bool running = captureRunning;
+	int kernel;
+
+	capture_stop();
+	cfg.chan_mask = 1 << __builtin_ctz(cfg.chan_mask);
+	cfg.block_size = 1024;
+	cfg.num_blocks = 3;
+	cfg.proc = PROC_NONE;
+	cfg.ring_irq = 1;
+
+	print_string("# bench kernel rate fail_rate why cycles load_pct\n");
+	for (kernel = 0; kernel < BENCH_NUM; kernel++) {
+		uint32_t rate, good = 0, good_match0 = 0, good_cycles = 0, fail = 0;
+		const char *why = "none";
+
+		for (rate = BENCH_RATE_STEP; rate <= max_rate; rate += BENCH_RATE_STEP) {
+			uint32_t cycles;
+			const char *err = bench_step(kernel, rate, &cycles);
+
+			if (err != NULL) {
+				fail = capture_rate(&cfg);
+				why = err;
+				break;
+			}
+			good = capture_rate(&cfg);
+			good_match0 = cfg.match0;
+			good_cycles = cycles;
+		}
+
+		print_string("# bench ");
+		print_string(benchNames[kernel]);
+		print_byte(' ');
+		print_decimal(good);
+		print_byte(' ');
+		print_decimal(fail);
+		print_byte(' ');
+		print_string(why);
+		print_byte(' ');
+		print_decimal(good_cycles);
+		print_byte(' ');
+		print_decimal(good ? good_cycles * 100 / (cfg.block_size * good_match0 / (cfg.dual ? 2 : 1)) : 0);
+		print_byte('\n');
 	}
 
-	// Use modulo 10 to get least significant digit.
-	// Then /10 to shift digits right and get next least significant digit.
-	while (n > 0) {
-		buf[i++] = '0' + n%10;
-		n /= 10;
+	cfg = saved;
+	if (running) {
+		capture_start();
 	}
+}
 
-	// Output digits in reverse order
-	do {
-		print_byte (buf[--i]);
-	} while (i>0);
+// bench : benchmark the block processing kernels, see bench_run()
+static void cmd_bench (int argc, char *argv[])
+{
+	bench_run();
+	cmd_reply_begin(true);
+	cmd_reply_end();
+}
 
+// start : start (or restart) capture
+static void cmd_start (int argc, char *argv[])
+{
+	// Also waits for any output of the previous capture still being sent
+	capture_stop();
+	capture_start();
+	cmd_reply_begin(true);
+	cmd_reply_end();
 }
 
-/**
- * @brief	DMA Interrupt Handler
- * @return	None
- */
-void DMA_IRQHandler(void)
+// stop : stop capture
+static void cmd_stop (int argc, char *argv[])
 {
-	// Pulse debug pin so can see when each DMA block ends on scope trace.
-	debug_pin_pulse (8);
+	capture_stop();
+	cmd_reply_begin(true);
+	cmd_reply_end();
+}
 
-	// Clear DMA interrupt for the channel
-	Chip_DMA_ClearActiveIntAChannel(LPC_DMA, DMA_CH0);
+// baud <rate> : change baud rate, see uart_baud_handshake()
+static void cmd_baud (int argc, char *argv[])
+{
+	uint32_t baud;
+
+	if (cmd_arg(argc, argv, 1, &baud)) {
+		uart_baud_handshake(baud);
+	}
+}
+
+// link <uart|uart_dma|spi> : transport binary frames are sent on (see transport.h)
+static void cmd_link (int argc, char *argv[])
+{
+	int i;
+
+	for (i = 0; i < TRANSPORT_NUM; i++) {
+		if (argc > 1 && strcmp(argv[1], transport_name(i)) == 0) {
+			transport_select(i);
+			cmd_reply_begin(true);
+			cmd_reply_end();
+			return;
+		}
+	}
+	cmd_reply_begin(false);
+	cmd_reply_word("arg");
+	cmd_reply_end();
+}
 
-	// Increment the DMA counter. When 3 the main loop knows we're done.
-	dmaBlockCount++;
+// stats : configuration and counters
+static void cmd_stats (int argc, char *argv[])
+{
+	cmd_reply_begin(true);
+	cmd_reply_field("running", captureRunning);
+	cmd_reply_field("mode", cfg.mode);
+	cmd_reply_field("chan", cfg.chan_mask);
+	cmd_reply_field("size", cfg.block_size);
+	cmd_reply_field("blocks", cfg.num_blocks);
+	cmd_reply_field("match0", cfg.match0);
+	cmd_reply_field("match2", cfg.match2);
+	cmd_reply_field("dual", cfg.dual);
+	cmd_reply_field("frac_num", cfg.frac_num);
+	cmd_reply_field("frac_len", cfg.frac_len);
+	cmd_reply_field("rate", capture_rate(&cfg));
+	cmd_reply_field("rate_x1000", capture_rate_x1000(&cfg));
+	cmd_reply_field("aggregate", numChannels * capture_rate(&cfg));
+	cmd_reply_field("baud", uart_get_baud());
+	cmd_reply_field("link", transport_get());
+	cmd_reply_field("spi_rate", spi_get_bitrate());
+	cmd_reply_field("produced", blockq.produced);
+	cmd_reply_field("dropped", blockq.dropped);
+	cmd_reply_field("overruns", blockq.overruns);
+	cmd_reply_field("adc_overruns", adcOverruns);
+	cmd_reply_field("dual_slips", dualSlips);
+	cmd_reply_field("ring_irq", cfg.ring_irq);
+	cmd_reply_field("ring_wakes", ringWakes);
+	cmd_reply_field("windows", trigWindows);
+	cmd_reply_field("proc", cfg.proc);
+	cmd_reply_field("proc_cycles", procCycles);
+	// Processing time as a percentage of the time taken to fill a block
+	cmd_reply_field("proc_pct",
+			procCycles * 100 / block_cycles());
+	cmd_reply_field("alarms", alarmCount);
+	cmd_reply_field("events", windowEvents);
+	cmd_reply_field("lat_us", windowLatency / (Chip_Clock_GetSystemClockRate() / 1000000));
+	cmd_reply_field("lat_max_us", windowLatencyMax / (Chip_Clock_GetSystemClockRate() / 1000000));
+	cmd_reply_field("policy", cfg.bp);
+	cmd_reply_field("shed", bpShed);
+	cmd_reply_field("reduced", bpReduced);
+	cmd_reply_field("restart_us",
+			restartCycles / (Chip_Clock_GetSystemClockRate() / 1000000));
+	cmd_reply_end();
 }
 
+static const CMD_T commands[] = {
+	{"rate", cmd_rate},
+	{"match", cmd_match},
+	{"chan", cmd_chan},
+	{"blocks", cmd_blocks},
+	{"size", cmd_size},
+	{"mode", cmd_mode},
+	{"seq", cmd_seq},
+	{"clock", cmd_clock},
+	{"irq", cmd_irq},
+	{"trig", cmd_trig},
+	{"proc", cmd_proc},
+	{"decim", cmd_decim},
+	{"tones", cmd_tones},
+	{"alarm", cmd_alarm},
+#if INSTR_ENABLE
+	{"instr", cmd_instr},
+#endif
+#if MTB_TRACE
+	{"mtb", cmd_mtb},
+#endif
+	{"start", cmd_start},
+	{"stop", cmd_stop},
+	{"baud", cmd_baud},
+	{"link", cmd_link},
+	{"policy", cmd_policy},
+	{"stats", cmd_stats},
+	{"bench", cmd_bench},
+};
+
 
 int main(void) {
 
-	int i;
+	//
+	// Free running SysTick for timestamps. No interrupt: count wraps every 2^24 cycles.
+	//
+	systick_init();
+	INSTR_INIT();
+	MTB_TRACE_INIT();
 
 	//
 	// Initialize GPIO
@@ -167,16 +2731,16 @@ int main(void) {
 	Chip_SWM_MovablePinAssign(SWM_U0_RXD_I, PIN_UART_RXD);
 	Chip_Clock_DisablePeriphClock(SYSCTL_CLOCK_SWM);
 
-	Chip_UART_Init(LPC_USART0);
-	Chip_UART_ConfigData(LPC_USART0,
-			UART_CFG_DATALEN_8
-			| UART_CFG_PARITY_NONE
-			| UART_CFG_STOPLEN_1);
+	uart_init(UART_BAUD_RATE);
+
+	if (LOW_POWER) {
+		uart_tx_sleep(true);
+		// Nothing uses the BOD. The watchdog oscillator is off since reset.
+		Chip_SYSCTL_PowerDown(SYSCTL_SLPWAKE_BOD_PD | SYSCTL_SLPWAKE_WDTOSC_PD);
+	}
 
-	Chip_Clock_SetUSARTNBaseClockRate((UART_BAUD_RATE * 16), true);
-	Chip_UART_SetBaud(LPC_USART0, UART_BAUD_RATE);
-	Chip_UART_TXEnable(LPC_USART0);
-	Chip_UART_Enable(LPC_USART0);
+	// CRC engine for binary frames
+	Chip_CRC_Init();
 
 
 
@@ -196,38 +2760,13 @@ int main(void) {
 	Chip_ADC_SetClockRate(LPC_ADC, ADC_MAX_SAMPLE_RATE);
 	Chip_ADC_SetDivider(LPC_ADC,0);
 
-	// Setup a sequencer A to do the following: (ref UM10800, 21.6.2, Table (undefined).)
-	// * Do conversions on channel ADC_CHANNEL only
-	// * Trigger sampling on SCT0_OUT3  See UM10800 §21.3.3, Table 276.
-	// Note, as far as I can tell, ADC_SEQ_CTRL_HWTRIG_* defines are incorrect for LPC824.
-	// * Mode END_OF_SEQ : trigger DMA/interrupt when sequence is complete.
-	Chip_ADC_SetupSequencer(LPC_ADC,
-							ADC_SEQA_IDX,
-							(ADC_SEQ_CTRL_CHANSEL(ADC_CHANNEL)
-							//| ADC_SEQ_CTRL_HWTRIG_SCT_OUT1
-							| (3<<12) // trig on SCT0_OUT3.
-							| ADC_SEQ_CTRL_MODE_EOS
-							)
-									);
-
-	// Enable fixed pin ADC3, ADC9 with SwitchMatrix. Cannot move ADC pins.
-	Chip_Clock_EnablePeriphClock(SYSCTL_CLOCK_SWM);
-	Chip_SWM_EnableFixedPin(SWM_FIXED_ADC3);
-	Chip_Clock_DisablePeriphClock(SYSCTL_CLOCK_SWM);
-
-	/* Clear all pending interrupts */
-	Chip_ADC_ClearFlags(LPC_ADC, Chip_ADC_GetFlags(LPC_ADC));
-
-
-	// This has impact on DMA operation. Why?
-	Chip_ADC_EnableInt(LPC_ADC, (ADC_INTEN_SEQA_ENABLE
-								//| ADC_INTEN_OVRRUN_ENABLE
-								));
-
-
-	/* Enable sequencer */
-	Chip_ADC_EnableSequencer(LPC_ADC, ADC_SEQA_IDX);
+	// Sequencer A and the channel pin are setup by capture_start()
 
+	// This has impact on DMA operation. Why? (The SEQA interrupt is the DMA
+	// trigger.) ADC_INTEN_OVRRUN_ENABLE is set by capture_start().
+	Chip_ADC_EnableInt(LPC_ADC, ADC_INTEN_SEQA_ENABLE);
+	// SEQB interrupt (not enabled in the NVIC) triggers DUAL_DMA_CH
+	Chip_ADC_EnableInt(LPC_ADC, ADC_INTEN_SEQB_ENABLE);
 
 
 
@@ -254,69 +2793,58 @@ int main(void) {
 					 | DMA_CFG_CHPRIORITY(0)
 					 ));
 
-	// Attempt to use ADC SEQA to trigger DMA xfer
-	Chip_DMATRIGMUX_SetInputTrig(LPC_DMATRIGMUX, DMA_CH0, DMATRIG_ADC_SEQA_IRQ);
+	// Same for the SEQB channel of dual sequencer capture
+	Chip_DMA_EnableIntChannel(LPC_DMA, DUAL_DMA_CH);
+	Chip_DMA_SetupChannelConfig(LPC_DMA, DUAL_DMA_CH,
+			(DMA_CFG_HWTRIGEN
+					| DMA_CFG_TRIGTYPE_EDGE
+					| DMA_CFG_TRIGPOL_HIGH
+					| DMA_CFG_TRIGBURST_BURST
+					| DMA_CFG_BURSTPOWER_1
+					| DMA_CFG_CHPRIORITY(0)
+					));
 
-	// DMA is performed in 3 separate chunks (as max allowed in one transfer
-	// is 1024 words). First to go is dmaDescA followed by B and C.
+	// Fractional sample period: one transfer per SCT DMA request 0, lower
+	// priority than the ADC channels
+	Chip_DMA_SetupChannelConfig(LPC_DMA, SCT_FRAC_DMA_CH,
+			(DMA_CFG_HWTRIGEN
+					| DMA_CFG_TRIGTYPE_EDGE
+					| DMA_CFG_TRIGPOL_HIGH
+					| DMA_CFG_TRIGBURST_SNGL
+					| DMA_CFG_CHPRIORITY(1)
+					));
 
-	// DMA descriptor for ADC to memory - note that addresses must
-	// be the END address for source and destination, not the starting address.
-	// DMA operations moves from end to start. [Ref ].
-	dmaDescC.xfercfg = 			 (
-			DMA_XFERCFG_CFGVALID  // Channel descriptor is considered valid
-			| DMA_XFERCFG_SETINTA // DMA Interrupt A (A vs B can be read in ISR)
-			| DMA_XFERCFG_WIDTH_16 // 8,16,32 bits allowed
-			| DMA_XFERCFG_SRCINC_0 // do not increment source
-			| DMA_XFERCFG_DSTINC_1 // increment dst by widthx1
-			| DMA_XFERCFG_XFERCOUNT(DMA_BUFFER_SIZE)
-			);
-	dmaDescC.source = DMA_ADDR ( (&LPC_ADC->DR[ADC_CHANNEL]) );
-	dmaDescC.dest = DMA_ADDR(&adc_buffer[DMA_BUFFER_SIZE*3 - 1]) ;
-	dmaDescC.next = DMA_ADDR(0); // no more descriptors
-
-	dmaDescB.xfercfg = 			 (
-			DMA_XFERCFG_CFGVALID  // Channel descriptor is considered valid
-			| DMA_XFERCFG_RELOAD  // Causes DMA to move to next descriptor when complete
-			| DMA_XFERCFG_SETINTA // DMA Interrupt A (A vs B can be read in ISR)
-			//| DMA_XFERCFG_SWTRIG  // When written by software, the trigger for this channel is set immediately.
-			| DMA_XFERCFG_WIDTH_16 // 8,16,32 bits allowed
-			| DMA_XFERCFG_SRCINC_0 // do not increment source
-			| DMA_XFERCFG_DSTINC_1 // increment dst by widthx1
-			| DMA_XFERCFG_XFERCOUNT(DMA_BUFFER_SIZE)
-			);
-	dmaDescB.source = DMA_ADDR ( (&LPC_ADC->DR[ADC_CHANNEL]) );
-	dmaDescB.dest = DMA_ADDR(&adc_buffer[DMA_BUFFER_SIZE*2 - 1]) ;
-	dmaDescB.next = (uint32_t)&dmaDescC;
-
-	// ADC data register is source of DMA
-	dmaDescA.source = DMA_ADDR ( (&LPC_ADC->DR[ADC_CHANNEL]) );
-	dmaDescA.dest = DMA_ADDR(&adc_buffer[DMA_BUFFER_SIZE - 1]) ;
-	dmaDescA.next = (uint32_t)&dmaDescB;
+	// DMA channel for USART0 TX
+	uart_dma_init();
 
+	// SPI0 and its DMA channel, for FRAME_SPI or "link spi"
+	Chip_Clock_EnablePeriphClock(SYSCTL_CLOCK_SWM);
+	Chip_SWM_MovablePinAssign(SWM_SPI0_SCK_IO, PIN_SPI_SCK);
+	Chip_SWM_MovablePinAssign(SWM_SPI0_MOSI_IO, PIN_SPI_MOSI);
+	Chip_SWM_MovablePinAssign(SWM_SPI0_SSEL0_IO, PIN_SPI_SSEL);
+	Chip_Clock_DisablePeriphClock(SYSCTL_CLOCK_SWM);
+	spi_init(SPI_BITRATE);
+	transport_select(FRAME_SPI ? TRANSPORT_SPI : UART_TX_DMA ? TRANSPORT_UART_DMA : TRANSPORT_UART);
 
+	// Attempt to use ADC SEQA to trigger DMA xfer
+	Chip_DMATRIGMUX_SetInputTrig(LPC_DMATRIGMUX, DMA_CH0, DMATRIG_ADC_SEQA_IRQ);
+	Chip_DMATRIGMUX_SetInputTrig(LPC_DMATRIGMUX, DUAL_DMA_CH, DMATRIG_ADC_SEQB_IRQ);
+	Chip_DMATRIGMUX_SetInputTrig(LPC_DMATRIGMUX, SCT_FRAC_DMA_CH, DMATRIG_SCT0_DMA0);
 
 	// Enable DMA interrupt. Will be invoked at end of DMA transfer.
 	NVIC_EnableIRQ(DMA_IRQn);
 
-	/* Setup transfer descriptor and validate it */
-	Chip_DMA_SetupTranChannel(LPC_DMA, DMA_CH0, &dmaDescA);
-	Chip_DMA_SetValidChannel(LPC_DMA, DMA_CH0);
+	// Threshold compare interrupt for CAPTURE_MODE_TRIGGER, enabled in the ADC
+	// by trigger_arm(). Lower priority than the DMA interrupt so that the block
+	// count is up to date when the DMA position is read.
+	NVIC_SetPriority(ADC_THCMP_IRQn, 1);
+	NVIC_EnableIRQ(ADC_THCMP_IRQn);
 
-	// Setup data transfer and hardware trigger
-	// See "Transfer Configuration registers" UM10800, §12.6.18, Table 173, page 179
-	Chip_DMA_SetupChannelTransfer(LPC_DMA, DMA_CH0,
-			 (
-				DMA_XFERCFG_CFGVALID  // Channel descriptor is considered valid
-				| DMA_XFERCFG_RELOAD  // Causes DMA to move to next descriptor when complete
-				| DMA_XFERCFG_SETINTA // DMA Interrupt A (A vs B can be read in ISR)
-				//| DMA_XFERCFG_SWTRIG  // When written by software, the trigger for this channel is set immediately.
-				| DMA_XFERCFG_WIDTH_16 // 8,16,32 bits allowed
-				| DMA_XFERCFG_SRCINC_0 // do not increment source
-				| DMA_XFERCFG_DSTINC_1 // increment dst by widthx1
-				| DMA_XFERCFG_XFERCOUNT(DMA_BUFFER_SIZE)
-				)
-				);
+	// ADC overrun counting, enabled in the ADC by capture_start()
+	NVIC_SetPriority(ADC_OVR_IRQn, 1);
+	NVIC_EnableIRQ(ADC_OVR_IRQn);
+
+	// Descriptors and channel transfer are setup by capture_start()
 
 
 	//
@@ -365,15 +2893,6 @@ int main(void) {
 	// Set SCT Counter to count 32-bits and reset to 0 after reaching MATCH0
 	Chip_SCT_Config(LPC_SCT, SCT_CONFIG_32BIT_COUNTER | SCT_CONFIG_AUTOLIMIT_L);
 
-
-
-
-
-	// Setup SCT for ADC/DMA sample timing.
-	uint32_t clock_hz =  Chip_Clock_GetSystemClockRate();
-	Chip_SCT_SetMatchReload(LPC_SCT, SCT_MATCH_2, (clock_hz/ADC_SAMPLE_RATE)/2 );
-	Chip_SCT_SetMatchReload(LPC_SCT, SCT_MATCH_0,  clock_hz/ADC_SAMPLE_RATE);
-
 	// Using SCT0_OUT3 to trigger ADC sampling
 	// Set SCT0_OUT3 on Event0 (Event0 configured to occur on Match0)
 	LPC_SCT->OUT[3].SET = 1 << 0;
@@ -385,47 +2904,87 @@ int main(void) {
 	Chip_SWM_MovablePinAssign(SWM_SCT_OUT3_O, PIN_SCT_DEBUG);
 	Chip_Clock_DisablePeriphClock(SYSCTL_CLOCK_SWM);
 
-	// Start SCT
-	Chip_SCT_ClearControl(LPC_SCT, SCT_CTRL_HALT_L | SCT_CTRL_HALT_H);
-
-
-
-	// Loop until dmaBlockCount==3 (this is updated in the DMA interrupt service routine)
-	dmaBlockCount = 0;
-	while (dmaBlockCount < 3) {
-		// Save power by sleeping as much as possible while waiting for DMAs to complete.
-		__WFI();
-	}
-
-	// Done with ADC sampling, stop and switch off SCT, ADC
-	Chip_SCT_DeInit(LPC_SCT);
-	Chip_ADC_DeInit(LPC_ADC);
-	NVIC_DisableIRQ(DMA_IRQn);
 
-	// DMA complete. Now shift ADC data register values 4 bits right to yield
-	// 12 bit ADC data in range 0 - 4095
-	for (i = 0; i < DMA_BUFFER_SIZE * 3; i++) {
-		adc_buffer[i] >>= 4;
+	//
+	// Start capture with the reset configuration. SCT sample timing is set
+	// from the SCT_MATCH_0 (period) and SCT_MATCH_2 (SCT0_OUT3 high) reload values.
+	//
+	cfg.mode = CAPTURE_MODE;
+	cfg.chan_mask = ADC_SEQ_CTRL_CHANSEL(ADC_CHANNEL);
+	cfg.block_size = DMA_BUFFER_SIZE;
+	cfg.num_blocks = DMA_NUM_BLOCKS;
+	cfg.trig_level = TRIG_LEVEL;
+	cfg.trig_pre = TRIG_PRE;
+	cfg.trig_post = TRIG_POST;
+	cfg.proc = PROCESS;
+	cfg.decim_r = DECIM_R;
+	cfg.tone_freq = TONE_FREQ;
+	cfg.tone_step = TONE_STEP;
+	cfg.tone_bins = TONE_BINS;
+	cfg.alarm_lo = ALARM_LO;
+	cfg.alarm_hi = ALARM_HI;
+	cfg.dual = DUAL_SEQ;
+	cfg.frac = SCT_FRACTIONAL;
+	capture_set_rate(&cfg, ADC_SAMPLE_RATE);
+	cfg.bp = BACKPRESSURE;
+	cfg.ring_irq = RING_IRQ;
+	if (LOW_LATENCY) {
+		cfg.mode = CAPTURE_MODE_STREAM;
+		cfg.block_size = LOWLAT_BLOCK_SIZE;
+		cfg.num_blocks = DMA_MAX_BLOCKS;
+		cfg.proc = PROC_WINDOW;
 	}
-
-	// Output ADC values to UART.
-	// Format: record-number adc-value.
-	// One record per line.  Suggest using GnuPlot to plot them.
-	for (i = 0; i < DMA_BUFFER_SIZE * 3; i++) {
-
-		// It would be nice to use libc, but complicates packing up for others to use.
-		//printf ("%d %d\n", i, adc_buffer[i]);
-
-		// Use simple UART printing functions embedded in C file instead of libc.
-		print_decimal(i);
-		print_byte(' ');
-		print_decimal(adc_buffer[i]);
-		print_byte('\n');
+	if (BENCH_AT_START) {
+		bench_run();
 	}
+	capture_start();
 
-	// Done. Sleep forever.
 	while (1) {
-		__WFI();
+		bool busy = false;
+
+		if (captureRunning) {
+			if (cfg.mode == CAPTURE_MODE_STREAM) {
+				if (cfg.ring_irq != 1) {
+					ring_poll();
+					// Without interrupts nothing would wake the core
+					busy = cfg.ring_irq == 0;
+				}
+				busy |= stream_poll();
+			} else if (cfg.mode == CAPTURE_MODE_HISTORY) {
+				if (history_poll()) {
+					// History full. Output it, "start" captures again.
+					capture_stop();
+					output_history();
+				}
+			} else if (cfg.mode == CAPTURE_MODE_TRIGGER) {
+				// Blocks are only used to track the DMA position
+				while (blockq_front(&blockq) != NULL) {
+					blockq_release(&blockq);
+				}
+				if (trigWindowReady) {
+					// Output the window and re-arm
+					capture_stop();
+					output_window();
+					capture_start();
+				}
+			} else if (blockq.produced >= cfg.num_blocks) {
+				// All blocks captured. Output ADC values to UART, "start"
+				// captures again.
+				capture_stop();
+				output_oneshot();
+			}
+		}
+
+		// Commands from the host. A command that changes the configuration
+		// restarts capture.
+		busy |= cmd_poll(commands, sizeof(commands)/sizeof(commands[0]));
+
+		// Save power by sleeping until the next interrupt. __WFE() rather than
+		// __WFI(): an interrupt taken since the checks above sets the event
+		// register, so there's no sleeping with work pending.
+		if ( ! busy) {
+			INSTR_SLEEP();
+		}
 	}
 
 }
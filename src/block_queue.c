@@ -0,0 +1,95 @@
+/*
+===============================================================================
+ Name        : block_queue.c
+ Description : Lock-free SPSC queue of completed DMA blocks. See block_queue.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include "block_queue.h"
+#include "ramfunc.h"
+
+void blockq_init (BLOCKQ_T *q, uint16_t num_blocks)
+{
+	q->head = 0;
+	q->tail = 0;
+	q->produced = 0;
+	q->dropped = 0;
+	q->overruns = 0;
+	q->num_blocks = num_blocks;
+	q->next_index = 0;
+}
+
+HOT_FUNC(blockq_publish)
+void blockq_publish (BLOCKQ_T *q, uint32_t timestamp)
+{
+	uint32_t head = q->head;
+	uint32_t seq = q->produced;
+
+	if (head - q->tail < BLOCKQ_SIZE) {
+		BLOCKQ_ENTRY_T *e = &q->entry[head & (BLOCKQ_SIZE-1)];
+		e->index = q->next_index;
+		e->flags = 0;
+		e->seq = seq;
+		e->timestamp = timestamp;
+		// Entry must be complete before the consumer can see it
+		__DMB();
+		q->head = head + 1;
+	} else {
+		q->dropped++;
+	}
+
+	if (++q->next_index == q->num_blocks) {
+		q->next_index = 0;
+	}
+	q->produced = seq + 1;
+}
+
+BLOCKQ_ENTRY_T *blockq_front (BLOCKQ_T *q)
+{
+	uint32_t tail = q->tail;
+
+	while (tail != q->head) {
+		// Don't read the entry before seeing the head that published it
+		__DMB();
+		BLOCKQ_ENTRY_T *e = &q->entry[tail & (BLOCKQ_SIZE-1)];
+		if (blockq_is_intact(q, e)) {
+			return e;
+		}
+		// Consumer too slow: DMA has already refilled this block
+		q->overruns++;
+		q->tail = ++tail;
+	}
+	return NULL;
+}
+
+BLOCKQ_ENTRY_T *blockq_peek (BLOCKQ_T *q, uint32_t i)
+{
+	uint32_t tail = q->tail;
+
+	if (q->head - tail <= i) {
+		return NULL;
+	}
+	__DMB();
+	return &q->entry[(tail + i) & (BLOCKQ_SIZE-1)];
+}
+
+bool blockq_release (BLOCKQ_T *q)
+{
+	uint32_t tail = q->tail;
+	bool intact = blockq_is_intact(q, &q->entry[tail & (BLOCKQ_SIZE-1)]);
+
+	if ( ! intact) {
+		q->overruns++;
+	}
+	__DMB();
+	q->tail = tail + 1;
+	return intact;
+}
@@ -0,0 +1,51 @@
+/*
+===============================================================================
+ Name        : blockstats.c
+ Description : Block summary statistics. See blockstats.h.
+===============================================================================
+*/
+
+#include "blockstats.h"
+#include "goertzel.h"
+#include "ramfunc.h"
+
+HOT_FUNC(bstats_block_dr)
+void bstats_block_dr (BSTATS_T *s, const uint16_t *dr, int n, int stride)
+{
+	uint32_t min = 0xffff, max = 0, sum = 0, crossings = 0;
+	uint64_t sumsq = 0;
+	uint32_t prev = (dr[0] >> 4) >= BSTATS_MID;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t x = *dr >> 4;
+		uint32_t pos = x >= BSTATS_MID;
+		dr += stride;
+		if (x < min) {
+			min = x;
+		}
+		if (x > max) {
+			max = x;
+		}
+		sum += x;
+		// x * x < 2^24, one 32 bit multiply
+		sumsq += x * x;
+		crossings += pos ^ prev;
+		prev = pos;
+	}
+
+	s->count = n;
+	s->min = min;
+	s->max = max;
+	s->crossings = crossings;
+	s->sum = sum;
+	s->sumsq = sumsq;
+}
+
+uint32_t bstats_ac_rms (const BSTATS_T *s)
+{
+	// n^2 variance = n sumsq - sum^2: n sumsq < 2^48, no overflow
+	uint64_t v = (uint64_t)s->count * s->sumsq - (uint64_t)s->sum * s->sum;
+
+	return goertzel_isqrt64(v) / s->count;
+}
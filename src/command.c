@@ -0,0 +1,182 @@
+/*
+===============================================================================
+ Name        : command.c
+ Description : Line based command parser on USART0 RX. See command.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include <string.h>
+
+#include "command.h"
+#include "uart.h"
+#include "instr.h"
+
+static char line[CMD_LINE_MAX + 1];
+static int lineLen = 0;
+// Line too long: discard up to the end of the line
+static bool lineOverflow = false;
+
+// Binary baud rate request: number of rate bytes received, or -1 if none in progress
+static int baudBytes = -1;
+static uint32_t baudRate;
+
+/**
+ * @brief Split the line into words and run the command.
+ */
+static void cmd_run (const CMD_T *table, int n)
+{
+	char *argv[CMD_MAX_ARGS];
+	int argc = 0;
+	char *p = line;
+	int i;
+
+	while (*p) {
+		while (*p == ' ') {
+			*p++ = '\0';
+		}
+		if (*p == '\0') {
+			break;
+		}
+		if (argc == CMD_MAX_ARGS) {
+			cmd_reply_begin(false);
+			cmd_reply_word("args");
+			cmd_reply_end();
+			return;
+		}
+		argv[argc++] = p;
+		while (*p && *p != ' ') {
+			p++;
+		}
+	}
+
+	if (argc == 0) {
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(argv[0], table[i].name) == 0) {
+			table[i].handler(argc, argv);
+			return;
+		}
+	}
+
+	cmd_reply_begin(false);
+	cmd_reply_word("unknown");
+	cmd_reply_word(argv[0]);
+	cmd_reply_end();
+}
+
+bool cmd_poll (const CMD_T *table, int n)
+{
+	bool rx = false;
+	int c;
+
+	while ( (c = uart_getc()) >= 0) {
+		rx = true;
+
+		if (baudBytes >= 0) {
+			baudRate |= (uint32_t)c << (8 * baudBytes);
+			if (++baudBytes == 4) {
+				baudBytes = -1;
+				uart_baud_handshake(baudRate);
+			}
+			continue;
+		}
+
+		if (c == '\n' || c == '\r') {
+			if (lineOverflow) {
+				cmd_reply_begin(false);
+				cmd_reply_word("length");
+				cmd_reply_end();
+			} else {
+				line[lineLen] = '\0';
+				cmd_run(table, n);
+			}
+			lineLen = 0;
+			lineOverflow = false;
+			continue;
+		}
+
+		if (lineLen == 0 && c == 'B' && ! lineOverflow) {
+			baudBytes = 0;
+			baudRate = 0;
+			continue;
+		}
+
+		if (lineLen == CMD_LINE_MAX) {
+			lineOverflow = true;
+		} else {
+			line[lineLen++] = c;
+		}
+	}
+
+	return rx;
+}
+
+bool cmd_parse_uint (const char *s, uint32_t *v)
+{
+	uint32_t base = 10;
+	uint32_t r = 0;
+
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		base = 16;
+		s += 2;
+	}
+	if (*s == '\0') {
+		return false;
+	}
+	for ( ; *s; s++) {
+		uint32_t d;
+		if (*s >= '0' && *s <= '9') {
+			d = *s - '0';
+		} else if (base == 16 && *s >= 'a' && *s <= 'f') {
+			d = *s - 'a' + 10;
+		} else if (base == 16 && *s >= 'A' && *s <= 'F') {
+			d = *s - 'A' + 10;
+		} else {
+			return false;
+		}
+		// Out of range, rather than wrap
+		if (r > (UINT32_MAX - d) / base) {
+			return false;
+		}
+		r = r * base + d;
+	}
+	*v = r;
+	return true;
+}
+
+void cmd_reply_begin (bool ok)
+{
+	while (uart_dma_busy()) {
+		INSTR_SLEEP();
+	}
+	print_string(ok ? "# ok" : "# err");
+}
+
+void cmd_reply_field (const char *name, int value)
+{
+	print_byte(' ');
+	print_string(name);
+	print_byte(' ');
+	print_decimal(value);
+}
+
+void cmd_reply_word (const char *s)
+{
+	print_byte(' ');
+	print_string(s);
+}
+
+void cmd_reply_end (void)
+{
+	print_byte('\n');
+}
@@ -0,0 +1,125 @@
+/*
+===============================================================================
+ Name        : decimate.c
+ Description : CIC + compensating FIR decimator. See decimate.h.
+===============================================================================
+*/
+
+#include "decimate.h"
+#include "ramfunc.h"
+
+// CIC output = comb output * norm >> DECIM_NORM_SHIFT. norm = 2^(DECIM_NORM_SHIFT+3) / R^3
+// gives a gain of 8 (ADC full scale to Q15 / 2).
+#define DECIM_NORM_SHIFT 28
+
+// Compensating FIR, Q15, symmetric: first half and centre tap. Least squares
+// design for 1/sinc^3 over 0 - 0.2 and 0 over 0.3 - 0.5 of the FIR input rate,
+// scaled for a DC gain of exactly 1. Sum of |taps| is 1.72, so the Q30
+// accumulator can't overflow.
+static const int16_t firTaps[DECIM_FIR_TAPS/2 + 1] = {
+	216, 373, -296, -919, 363, 1908, -298, -3940, -449, 10769, 17314
+};
+
+void decim_init (DECIM_T *d, int r)
+{
+	int i;
+
+	for (i = 0; i < DECIM_CIC_ORDER; i++) {
+		d->integ[i] = 0;
+		d->comb[i] = 0;
+	}
+	for (i = 0; i < 2 * DECIM_FIR_TAPS; i++) {
+		d->fir[i] = 0;
+	}
+	d->r = r;
+	d->norm = ((uint32_t)1 << (DECIM_NORM_SHIFT + 3)) / ((uint32_t)r * r * r);
+	d->phase = 0;
+	d->fir_pos = 0;
+	d->fir_phase = 0;
+}
+
+/**
+ * @brief Add a sample to the FIR delay line and, every other sample, compute an
+ * output. Each sample is stored at fir_pos and fir_pos + DECIM_FIR_TAPS so
+ * that the last DECIM_FIR_TAPS samples are always contiguous from fir_pos,
+ * newest first, without any index wrapping in the convolution.
+ * @return true if *y has been set to an output
+ */
+HOT_FUNC(fir_push)
+static int fir_push (DECIM_T *d, int16_t x, int16_t *y)
+{
+	const int16_t *h;
+	int32_t acc;
+	int pos = d->fir_pos;
+	int j;
+
+	pos = (pos == 0 ? DECIM_FIR_TAPS : pos) - 1;
+	d->fir[pos] = x;
+	d->fir[pos + DECIM_FIR_TAPS] = x;
+	d->fir_pos = pos;
+
+	if (++d->fir_phase < 2) {
+		return 0;
+	}
+	d->fir_phase = 0;
+
+	h = &d->fir[pos];
+	acc = (int32_t)firTaps[DECIM_FIR_TAPS/2] * h[DECIM_FIR_TAPS/2];
+	for (j = 0; j < DECIM_FIR_TAPS/2; j++) {
+		acc += (int32_t)firTaps[j] * (h[j] + h[DECIM_FIR_TAPS - 1 - j]);
+	}
+
+	// Round and saturate Q30 to Q15
+	acc = (acc + (1 << 14)) >> 15;
+	if (acc > 32767) {
+		acc = 32767;
+	} else if (acc < -32768) {
+		acc = -32768;
+	}
+	*y = acc;
+	return 1;
+}
+
+HOT_FUNC(decim_process_dr)
+int decim_process_dr (DECIM_T *d, const uint16_t *dr, int n, int16_t *out)
+{
+	// Integrators in registers for the inner loop. Unsigned: CIC integrators
+	// rely on wrap around, and the comb output is exact as long as it fits.
+	uint32_t i0 = d->integ[0];
+	uint32_t i1 = d->integ[1];
+	uint32_t i2 = d->integ[2];
+	int phase = d->phase;
+	int r = d->r;
+	int o = 0;
+	int k;
+
+	for (k = 0; k < n; k++) {
+		i0 += (int32_t)(dr[k] >> 4) - 2048;
+		i1 += i0;
+		i2 += i1;
+
+		if (++phase == r) {
+			uint32_t c0, c1, c2;
+			int16_t y;
+
+			phase = 0;
+			c0 = i2 - d->comb[0];
+			d->comb[0] = i2;
+			c1 = c0 - d->comb[1];
+			d->comb[1] = c0;
+			c2 = c1 - d->comb[2];
+			d->comb[2] = c1;
+
+			y = ((int64_t)(int32_t)c2 * d->norm) >> DECIM_NORM_SHIFT;
+			if (fir_push(d, y, &out[o])) {
+				o++;
+			}
+		}
+	}
+
+	d->integ[0] = i0;
+	d->integ[1] = i1;
+	d->integ[2] = i2;
+	d->phase = phase;
+	return o;
+}
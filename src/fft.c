@@ -0,0 +1,173 @@
+/*
+===============================================================================
+ Name        : fft.c
+ Description : In place fixed point FFT power spectrum. See fft.h.
+===============================================================================
+*/
+
+#include "fft.h"
+#include "ramfunc.h"
+
+// sin(2 pi k / FFT_MAX_N) in Q15, k = 0 to FFT_MAX_N / 4
+static const int16_t sinTable[FFT_MAX_N/4 + 1] = {
+	0, 201, 402, 603, 804, 1005, 1206, 1407,
+	1608, 1809, 2009, 2210, 2410, 2611, 2811, 3012,
+	3212, 3412, 3612, 3811, 4011, 4210, 4410, 4609,
+	4808, 5007, 5205, 5404, 5602, 5800, 5998, 6195,
+	6393, 6590, 6786, 6983, 7179, 7375, 7571, 7767,
+	7962, 8157, 8351, 8545, 8739, 8933, 9126, 9319,
+	9512, 9704, 9896, 10087, 10278, 10469, 10659, 10849,
+	11039, 11228, 11417, 11605, 11793, 11980, 12167, 12353,
+	12539, 12725, 12910, 13094, 13279, 13462, 13645, 13828,
+	14010, 14191, 14372, 14553, 14732, 14912, 15090, 15269,
+	15446, 15623, 15800, 15976, 16151, 16325, 16499, 16673,
+	16846, 17018, 17189, 17360, 17530, 17700, 17869, 18037,
+	18204, 18371, 18537, 18703, 18868, 19032, 19195, 19357,
+	19519, 19680, 19841, 20000, 20159, 20317, 20475, 20631,
+	20787, 20942, 21096, 21250, 21403, 21554, 21705, 21856,
+	22005, 22154, 22301, 22448, 22594, 22739, 22884, 23027,
+	23170, 23311, 23452, 23592, 23731, 23870, 24007, 24143,
+	24279, 24413, 24547, 24680, 24811, 24942, 25072, 25201,
+	25329, 25456, 25582, 25708, 25832, 25955, 26077, 26198,
+	26319, 26438, 26556, 26674, 26790, 26905, 27019, 27133,
+	27245, 27356, 27466, 27575, 27683, 27790, 27896, 28001,
+	28105, 28208, 28310, 28411, 28510, 28609, 28706, 28803,
+	28898, 28992, 29085, 29177, 29268, 29358, 29447, 29534,
+	29621, 29706, 29791, 29874, 29956, 30037, 30117, 30195,
+	30273, 30349, 30424, 30498, 30571, 30643, 30714, 30783,
+	30852, 30919, 30985, 31050, 31113, 31176, 31237, 31297,
+	31356, 31414, 31470, 31526, 31580, 31633, 31685, 31736,
+	31785, 31833, 31880, 31926, 31971, 32014, 32057, 32098,
+	32137, 32176, 32213, 32250, 32285, 32318, 32351, 32382,
+	32412, 32441, 32469, 32495, 32521, 32545, 32567, 32589,
+	32609, 32628, 32646, 32663, 32678, 32692, 32705, 32717,
+	32728, 32737, 32745, 32752, 32757, 32761, 32765, 32766,
+	32767,
+};
+
+/**
+ * @brief sin(2 pi i / FFT_MAX_N), Q15.
+ */
+HOT_FUNC(fft_sin)
+static int32_t fft_sin (unsigned int i)
+{
+	unsigned int r = i % (FFT_MAX_N/4);
+
+	switch ((i / (FFT_MAX_N/4)) % 4) {
+	case 0: return sinTable[r];
+	case 1: return sinTable[FFT_MAX_N/4 - r];
+	case 2: return -sinTable[r];
+	default: return -sinTable[FFT_MAX_N/4 - r];
+	}
+}
+
+/**
+ * @brief cos(2 pi i / FFT_MAX_N), Q15.
+ */
+HOT_FUNC(fft_cos)
+static int32_t fft_cos (unsigned int i)
+{
+	return fft_sin(i + FFT_MAX_N/4);
+}
+
+HOT_FUNC(fft_complex)
+void fft_complex (int16_t *z, int m)
+{
+	int i, j, k, h;
+
+	// Bit reversed order
+	for (i = 1, j = 0; i < m; i++) {
+		int bit = m >> 1;
+		for ( ; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i < j) {
+			int16_t t;
+			t = z[2*i]; z[2*i] = z[2*j]; z[2*j] = t;
+			t = z[2*i+1]; z[2*i+1] = z[2*j+1]; z[2*j+1] = t;
+		}
+	}
+
+	// Decimation in time butterflies, each twiddle factor used for every group
+	// of the stage before moving on
+	for (h = 1; h < m; h <<= 1) {
+		int step = FFT_MAX_N / (2*h);
+		for (j = 0; j < h; j++) {
+			int32_t wr = fft_cos(j * step);
+			int32_t wi = -fft_sin(j * step);
+			for (k = j; k < m; k += 2*h) {
+				int16_t *a = z + 2*k;
+				int16_t *b = z + 2*(k + h);
+				int32_t tr = (wr * b[0] - wi * b[1]) >> 15;
+				int32_t ti = (wr * b[1] + wi * b[0]) >> 15;
+				int32_t ar = a[0], ai = a[1];
+				a[0] = (ar + tr) >> 1;
+				a[1] = (ai + ti) >> 1;
+				b[0] = (ar - tr) >> 1;
+				b[1] = (ai - ti) >> 1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Store a power value as 2 uint16, low half first.
+ */
+HOT_FUNC(put_power)
+static void put_power (uint16_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 16;
+}
+
+HOT_FUNC(fft_power_dr)
+void fft_power_dr (uint16_t *buf, int n)
+{
+	int16_t *z = (int16_t *)buf;
+	int m = n / 2;
+	int i, k;
+
+	// Q15, Hann window (1 - cos) / 2
+	for (i = 0; i < n; i++) {
+		int32_t x = ((int32_t)(buf[i] >> 4) - 2048) << 3;
+		int32_t w = (32768 - fft_cos(i * (FFT_MAX_N / n))) >> 1;
+		z[i] = (x * w) >> 15;
+	}
+
+	fft_complex(z, m);
+
+	// Split into the real FFT. With A = Z(k), B = conj(Z(m - k)), E = A + B,
+	// O = -j(A - B) and W = exp(-2 pi j k / n):
+	// X(k) / n = (E + W O) / 4, X(m - k) / n = conj(E - W O) / 4.
+	// Both bins are computed together and overwrite Z(k) and Z(m - k).
+	{
+		int32_t r0 = z[0], i0 = z[1];
+		int32_t dc = (r0 + i0) >> 1;
+		put_power(buf, (uint32_t)(dc * dc));
+	}
+	for (k = 1; k <= m / 2; k++) {
+		int16_t *a = z + 2*k;
+		int16_t *b = z + 2*(m - k);
+		int32_t er = a[0] + b[0];
+		int32_t ei = a[1] - b[1];
+		int32_t or_ = a[1] + b[1];
+		int32_t oi = b[0] - a[0];
+		int32_t wr = fft_cos(k * (FFT_MAX_N / n));
+		int32_t wi = -fft_sin(k * (FFT_MAX_N / n));
+		int32_t tr = (wr * or_ - wi * oi) >> 15;
+		int32_t ti = (wr * oi + wi * or_) >> 15;
+		int32_t xr, xi;
+
+		// (E +/- W O) / 2 keeps the squares within 32 bits, the other / 2 is
+		// applied to the power as / 4
+		xr = (er + tr) >> 1;
+		xi = (ei + ti) >> 1;
+		put_power((uint16_t *)a, ((uint32_t)(xr * xr) + (uint32_t)(xi * xi)) >> 2);
+		if (k != m - k) {
+			xr = (er - tr) >> 1;
+			xi = (ei - ti) >> 1;
+			put_power((uint16_t *)b, ((uint32_t)(xr * xr) + (uint32_t)(xi * xi)) >> 2);
+		}
+	}
+}
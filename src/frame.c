@@ -0,0 +1,106 @@
+/*
+===============================================================================
+ Name        : frame.c
+ Description : Binary frame format. See frame.h.
+===============================================================================
+*/
+
+#include "frame.h"
+#include "ramfunc.h"
+
+static uint16_t get16 (const uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get32 (const uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+void frame_header_write (const FRAME_HEADER_T *h, uint8_t *buf)
+{
+	frame_put16(&buf[0], FRAME_SYNC);
+	buf[2] = h->version;
+	buf[3] = h->type;
+	frame_put32(&buf[4], h->seq);
+	frame_put32(&buf[8], h->sample_rate);
+	frame_put16(&buf[12], h->sample_count);
+	frame_put16(&buf[14], h->payload_len);
+	frame_put16(&buf[16], h->chan_mask);
+	frame_put16(&buf[18], h->ratio);
+	frame_put16(&buf[20], h->adc_overruns);
+	frame_put16(&buf[22], h->lost_blocks);
+	frame_put16(&buf[24], h->crc);
+}
+
+int frame_header_read (const uint8_t *buf, FRAME_HEADER_T *h)
+{
+	if (get16(&buf[0]) != FRAME_SYNC) {
+		return -1;
+	}
+	h->version = buf[2];
+	h->type = buf[3];
+	h->seq = get32(&buf[4]);
+	h->sample_rate = get32(&buf[8]);
+	h->sample_count = get16(&buf[12]);
+	h->payload_len = get16(&buf[14]);
+	h->chan_mask = get16(&buf[16]);
+	h->ratio = get16(&buf[18]);
+	h->adc_overruns = get16(&buf[20]);
+	h->lost_blocks = get16(&buf[22]);
+	h->crc = get16(&buf[24]);
+	return 0;
+}
+
+HOT_FUNC(frame_pack12)
+int frame_pack12 (const uint16_t *in, int n, uint8_t *out)
+{
+	uint8_t *p = out;
+	int i;
+
+	// Both samples are read before any output byte is written, and output
+	// never gets ahead of input, so packing in place is safe.
+	for (i = 0; i + 1 < n; i += 2) {
+		uint16_t a = in[i];
+		uint16_t b = in[i+1];
+		p[0] = a;
+		p[1] = (a >> 8) | (b << 4);
+		p[2] = b >> 4;
+		p += 3;
+	}
+	if (i < n) {
+		uint16_t a = in[i];
+		p[0] = a;
+		p[1] = a >> 8;
+		p += 2;
+	}
+	return p - out;
+}
+
+void frame_unpack12 (const uint8_t *in, int n, uint16_t *out)
+{
+	int i;
+
+	for (i = 0; i + 1 < n; i += 2) {
+		out[i] = in[0] | ((in[1] & 0x0f) << 8);
+		out[i+1] = (in[1] >> 4) | (in[2] << 4);
+		in += 3;
+	}
+	if (i < n) {
+		out[i] = in[0] | ((in[1] & 0x0f) << 8);
+	}
+}
+
+uint16_t frame_crc16 (uint16_t crc, const uint8_t *buf, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		crc ^= (uint16_t)buf[i] << 8;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
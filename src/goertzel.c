@@ -0,0 +1,113 @@
+/*
+===============================================================================
+ Name        : goertzel.c
+ Description : Goertzel tone detector bank. See goertzel.h.
+===============================================================================
+*/
+
+#include "goertzel.h"
+#include "ramfunc.h"
+
+// pi/2 in Q30
+#define HALF_PI_Q30 1686629713
+
+/**
+ * @brief cos(x) for 0 <= x <= pi/2, x in Q30, result in Q30. Taylor series to
+ * x^8: error below 3e-5, under half a Q14 LSB.
+ */
+static int32_t cos_q30 (int32_t x)
+{
+	int64_t x2 = ((int64_t)x * x) >> 30;
+	const int64_t one = (int64_t)1 << 30;
+	int64_t c;
+
+	// 1 - x^2/2 (1 - x^2/12 (1 - x^2/30 (1 - x^2/56)))
+	c = one - x2 / 56;
+	c = one - ((x2 * c) >> 30) / 30;
+	c = one - ((x2 * c) >> 30) / 12;
+	c = one - ((x2 * c) >> 30) / 2;
+	return c;
+}
+
+int32_t goertzel_cos_q14 (uint32_t turn)
+{
+	// Angle within the quadrant, Q30 radians
+	int32_t a = ((uint64_t)(turn & 0x3fffffff) * HALF_PI_Q30) >> 30;
+	int32_t c;
+
+	switch (turn >> 30) {
+	case 0: c = cos_q30(a); break;
+	case 1: c = -cos_q30(HALF_PI_Q30 - a); break;
+	case 2: c = -cos_q30(a); break;
+	default: c = cos_q30(HALF_PI_Q30 - a); break;
+	}
+	// Q30 to Q14, rounded
+	return (c + (1 << 15)) >> 16;
+}
+
+uint32_t goertzel_isqrt64 (uint64_t v)
+{
+	uint64_t r = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+
+	while (bit > v) {
+		bit >>= 2;
+	}
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+void goertzel_init (GOERTZEL_T *g, const uint32_t *freq, int nbins, uint32_t sample_rate)
+{
+	int i;
+
+	g->nbins = nbins;
+	for (i = 0; i < nbins; i++) {
+		uint32_t turn = ((uint64_t)freq[i] << 32) / sample_rate;
+		int32_t c = 2 * goertzel_cos_q14(turn);
+		// 2cos(0) = 2.0 doesn't fit Q14 in 16 bits, which the split multiply needs
+		if (c > 32767) {
+			c = 32767;
+		}
+		g->freq[i] = freq[i];
+		g->coeff[i] = c;
+	}
+}
+
+HOT_FUNC(goertzel_block_dr)
+void goertzel_block_dr (const GOERTZEL_T *g, const uint16_t *dr, int n, uint32_t *mag)
+{
+	int b, k;
+
+	for (b = 0; b < g->nbins; b++) {
+		const int32_t c = g->coeff[b];
+		int32_t s1 = 0, s2 = 0;
+		int64_t cs1, p;
+
+		for (k = 0; k < n; k++) {
+			int32_t x = (int32_t)(dr[k] >> 4) - 2048;
+			// (c * s1) >> 14 with s1 = hi * 2^16 + lo: c * hi * 2^16 >> 14 is
+			// exact, and c * lo fits in 32 bits for lo < 2^16, |c| <= 2^15.
+			int32_t hi = s1 >> 16;
+			uint32_t lo = s1 & 0xffff;
+			int32_t cs1 = ((c * hi) << 2) + ((c * (int32_t)lo) >> 14);
+			int32_t s = x + cs1 - s2;
+			s2 = s1;
+			s1 = s;
+		}
+
+		// |X|^2 = s1^2 + s2^2 - coeff * s1 * s2, shifting coeff * s1 before the
+		// second multiply so the product stays within 64 bits
+		cs1 = ((int64_t)c * s1) >> 14;
+		p = (int64_t)s1 * s1 + (int64_t)s2 * s2 - cs1 * s2;
+		mag[b] = goertzel_isqrt64(p < 0 ? 0 : p);
+	}
+}
@@ -0,0 +1,70 @@
+/*
+===============================================================================
+ Name        : history.c
+ Description : Packed 12 bit sample history ring. See history.h.
+===============================================================================
+*/
+
+#include "history.h"
+#include "ramfunc.h"
+
+void hist_init (HIST_T *h, uint8_t *buf, uint32_t len)
+{
+	h->buf = buf;
+	h->size = hist_capacity(len);
+	h->count = 0;
+	h->wr = 0;
+}
+
+HOT_FUNC(hist_write_dr)
+void hist_write_dr (HIST_T *h, const uint16_t *dr, uint32_t n, uint32_t stride)
+{
+	uint32_t end = (h->size / 2) * 3;
+	uint8_t *p = h->buf + h->wr;
+	uint32_t i;
+
+	for (i = 0; i < n; i += 2) {
+		// Bits 15:4 of the ADC data register hold the ADC value
+		uint32_t a = dr[0] >> 4;
+		uint32_t b = dr[stride] >> 4;
+		p[0] = a;
+		p[1] = (a >> 8) | (b << 4);
+		p[2] = b >> 4;
+		p += 3;
+		dr += 2 * stride;
+		if (p == h->buf + end) {
+			p = h->buf;
+		}
+	}
+
+	h->wr = p - h->buf;
+	h->count += n;
+}
+
+/**
+ * @brief Byte offset in the ring of the pair holding sample s.
+ */
+static uint32_t pair_offset (const HIST_T *h, uint32_t s)
+{
+	return ((s % h->size) / 2) * 3;
+}
+
+uint16_t hist_get (const HIST_T *h, uint32_t s)
+{
+	const uint8_t *p = h->buf + pair_offset(h, s);
+
+	if (s & 1) {
+		return (p[1] >> 4) | (p[2] << 4);
+	}
+	return p[0] | ((p[1] & 0x0f) << 8);
+}
+
+const uint8_t *hist_span (const HIST_T *h, uint32_t s, uint32_t *n)
+{
+	uint32_t left = h->size - (s % h->size);
+
+	if (*n > left) {
+		*n = left;
+	}
+	return h->buf + pair_offset(h, s);
+}
@@ -0,0 +1,129 @@
+/*
+===============================================================================
+ Name        : instr.c
+ Description : Hot path instrumentation. See instr.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include "instr.h"
+
+#if INSTR_ENABLE
+
+INSTR_STAGE_T instrStage[INSTR_NUM_STAGES];
+
+static const char * const stageNames[INSTR_NUM_STAGES] = {
+	"dma_isr", "thcmp_isr", "uart_isr", "handoff", "proc", "tx", "awake", "asleep"
+};
+
+volatile uint8_t instrIsrDepth = 0;
+
+// MRT time of the last wake up from instr_sleep()
+static uint32_t wakeTime;
+// Set while in instr_sleep(), from the start of the asleep time to wake up
+static volatile bool sleeping;
+// Handler time inside instr_sleep(), which the asleep stage includes
+static uint64_t isrAsleep;
+
+/**
+ * @brief MRT channel INSTR_MRT_CH counts down, so the count is inverted to give
+ * a 31 bit up-counter of system clock cycles.
+ * @return Cycle count modulo 2^31
+ */
+static inline uint32_t mrt_now (void)
+{
+	return MRT_INTVAL_IVALUE - Chip_MRT_GetTimer(LPC_MRT_CH(INSTR_MRT_CH));
+}
+
+void instr_init (void)
+{
+	Chip_MRT_Init();
+	Chip_MRT_SetMode(LPC_MRT_CH(INSTR_MRT_CH), MRT_MODE_REPEAT);
+	Chip_MRT_SetInterval(LPC_MRT_CH(INSTR_MRT_CH), MRT_INTVAL_IVALUE | MRT_INTVAL_LOAD);
+	wakeTime = mrt_now();
+}
+
+void instr_sleep (void)
+{
+	uint32_t t = mrt_now();
+
+	sleeping = true;
+	instr_record(INSTR_AWAKE, (t - wakeTime) & MRT_INTVAL_IVALUE);
+	__WFE();
+	wakeTime = mrt_now();
+	sleeping = false;
+	instr_record(INSTR_ASLEEP, (wakeTime - t) & MRT_INTVAL_IVALUE);
+}
+
+uint32_t instr_duty_permille (void)
+{
+	uint64_t active, total;
+
+	// isrAsleep is updated by interrupt handlers
+	__disable_irq();
+	active = instrStage[INSTR_AWAKE].total + isrAsleep;
+	__enable_irq();
+	total = instrStage[INSTR_AWAKE].total + instrStage[INSTR_ASLEEP].total;
+
+	if (total == 0) {
+		return 0;
+	}
+	return (uint32_t)(active * 1000 / total);
+}
+
+void instr_record (int stage, uint32_t cycles)
+{
+	INSTR_STAGE_T *s = &instrStage[stage];
+
+	if (s->count == 0 || cycles < s->min) {
+		s->min = cycles;
+	}
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	s->total += cycles;
+	s->count++;
+}
+
+void instr_record_isr (int stage, uint32_t cycles)
+{
+	instr_record(stage, cycles);
+	// A nested handler is inside the outer one's time. A higher priority one
+	// can still preempt here, so isrAsleep is updated with interrupts off.
+	__disable_irq();
+	if (--instrIsrDepth == 0 && sleeping) {
+		isrAsleep += cycles;
+	}
+	__enable_irq();
+}
+
+void instr_reset (void)
+{
+	int i;
+
+	// Stages can be updated by interrupt handlers
+	__disable_irq();
+	for (i = 0; i < INSTR_NUM_STAGES; i++) {
+		instrStage[i].count = 0;
+		instrStage[i].min = 0;
+		instrStage[i].max = 0;
+		instrStage[i].total = 0;
+	}
+	isrAsleep = 0;
+	wakeTime = mrt_now();
+	__enable_irq();
+}
+
+const char *instr_name (int stage)
+{
+	return stageNames[stage];
+}
+
+#endif /* INSTR_ENABLE */
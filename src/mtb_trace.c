@@ -0,0 +1,76 @@
+/*
+===============================================================================
+ Name        : mtb_trace.c
+ Description : MTB trace of the hot path for profiling. See mtb_trace.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include "mtb_trace.h"
+
+#if MTB_TRACE
+
+// Same default as src/mtb.c, which defines the buffer
+#if !defined (__MTB_BUFFER_SIZE)
+#define __MTB_BUFFER_SIZE 128
+#endif
+
+#if !defined (__CODE_RED) || defined (__MTB_DISABLE) || (__MTB_BUFFER_SIZE < 32)
+#error "MTB_TRACE needs the __mtb_buffer__ from mtb.c, at least 32 bytes"
+#endif
+
+// Defined by src/mtb.c, aligned to its size
+extern char __mtb_buffer__[];
+
+volatile uint8_t mtbDepth = 0;
+volatile uint32_t mtbMaster = 0;
+
+/**
+ * @brief POSITION / FLOW value for a buffer address: the offset in SRAM.
+ */
+static uint32_t mtb_pointer (const char *p)
+{
+	return ((uint32_t)p - MTB_BASE) & MTB_POINTER_MASK;
+}
+
+void mtb_trace_init (void)
+{
+	MTB_MASTER = 0;
+	mtb_trace_arm();
+}
+
+void mtb_trace_arm (void)
+{
+	// MASK: the buffer is 2^(MASK+4) bytes
+	const uint32_t mask = __builtin_ctz(__MTB_BUFFER_SIZE) - 4;
+
+	MTB_MASTER = 0;
+	MTB_POSITION = mtb_pointer(__mtb_buffer__);
+	// Stop two packets short of the end. Whether the packet at the watermark is
+	// written or not, the pointer then never wraps.
+	MTB_FLOW = mtb_pointer(&__mtb_buffer__[__MTB_BUFFER_SIZE - 2 * MTB_PACKET_LEN])
+			| MTB_FLOW_AUTOSTOP;
+	mtbMaster = MTB_MASTER_EN | mask;
+}
+
+int mtb_trace_get (const uint8_t **buf, bool *full)
+{
+	uint32_t pos;
+
+	mtbMaster = 0;
+	MTB_MASTER = 0;
+	pos = MTB_POSITION & MTB_POINTER_MASK;
+
+	*buf = (const uint8_t *)__mtb_buffer__;
+	*full = pos >= (MTB_FLOW & MTB_POINTER_MASK);
+	return (pos - mtb_pointer(__mtb_buffer__)) / MTB_PACKET_LEN;
+}
+
+#endif /* MTB_TRACE */
@@ -0,0 +1,147 @@
+/*
+===============================================================================
+ Name        : rice.c
+ Description : Lossless delta + Rice coding. See rice.h.
+===============================================================================
+*/
+
+#include "rice.h"
+#include "ramfunc.h"
+
+/**
+ * @brief Map a difference to an unsigned value: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+ */
+HOT_FUNC(zigzag)
+static uint32_t zigzag (int32_t d)
+{
+	return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+HOT_FUNC(rice_encode_dr)
+int rice_encode_dr (uint16_t *buf, int n, int stride)
+{
+	uint16_t prev[RICE_MAX_STRIDE];
+	uint8_t *p = (uint8_t *)buf;
+	uint32_t sum = 0, acc;
+	int nbits, i, c, k;
+
+	// Choose k: 2^k <= mean(u) < 2^(k+1)
+	for (i = stride; i < n; i++) {
+		sum += zigzag((int32_t)(buf[i] >> 4) - (int32_t)(buf[i - stride] >> 4));
+	}
+	for (k = 0; k < RICE_MAX_K && ((uint32_t)(n - stride) << (k + 1)) <= sum; k++) {
+	}
+
+	// Header shares the first 2 bytes with the first sample, which is read first
+	prev[0] = buf[0] >> 4;
+	acc = k | (prev[0] << 4);
+	nbits = 16;
+
+	// Output bytes are only written for samples already read
+	for (i = 1, c = 1 % stride; i < n; i++) {
+		uint32_t x = buf[i] >> 4;
+
+		if (i < stride) {
+			acc |= x << nbits;
+			nbits += 12;
+		} else {
+			uint32_t u = zigzag((int32_t)x - (int32_t)prev[c]);
+			uint32_t q = u >> k;
+			if (q < RICE_ESCAPE) {
+				acc |= (((1u << q) - 1) | ((u & ((1u << k) - 1)) << (q + 1))) << nbits;
+				nbits += q + 1 + k;
+			} else {
+				acc |= (((1u << RICE_ESCAPE) - 1) | (x << RICE_ESCAPE)) << nbits;
+				nbits += RICE_ESCAPE + 12;
+			}
+		}
+		prev[c] = x;
+		if (++c == stride) {
+			c = 0;
+		}
+
+		while (nbits >= 8) {
+			*p++ = acc;
+			acc >>= 8;
+			nbits -= 8;
+		}
+	}
+	while (nbits > 0) {
+		*p++ = acc;
+		acc >>= 8;
+		nbits -= 8;
+	}
+	return p - (uint8_t *)buf;
+}
+
+int rice_decode (const uint8_t *in, int len, uint16_t *out, int n, int stride)
+{
+	const uint8_t *end = in + len;
+	uint32_t acc = 0;
+	int nbits = 0, i = 0, k = -1;
+
+	while (i < n) {
+		uint32_t q, x;
+
+		// Refill: the longest field, a whole code, is 16 bits
+		while (nbits <= 24 && in < end) {
+			acc |= (uint32_t)*in++ << nbits;
+			nbits += 8;
+		}
+		if (k < 0) {
+			if (nbits < 4) {
+				return -1;
+			}
+			k = acc & 0xf;
+			acc >>= 4;
+			nbits -= 4;
+			if (k > RICE_MAX_K) {
+				return -1;
+			}
+			continue;
+		}
+
+		if (i < stride) {
+			if (nbits < 12) {
+				return -1;
+			}
+			x = acc & 0xfff;
+			acc >>= 12;
+			nbits -= 12;
+		} else {
+			for (q = 0; q < RICE_ESCAPE && (acc & 1); q++) {
+				acc >>= 1;
+				nbits--;
+			}
+			if (q == RICE_ESCAPE) {
+				if (nbits < 12) {
+					return -1;
+				}
+				x = acc & 0xfff;
+				acc >>= 12;
+				nbits -= 12;
+			} else {
+				uint32_t u;
+				int32_t d;
+				// Zero terminating the unary part, then k bits
+				if (nbits < 1 + k) {
+					return -1;
+				}
+				acc >>= 1;
+				u = (q << k) | (acc & ((1u << k) - 1));
+				acc >>= k;
+				nbits -= 1 + k;
+				d = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+				x = out[i - stride] + d;
+				if (x > 4095) {
+					return -1;
+				}
+			}
+		}
+		if (nbits < 0) {
+			return -1;
+		}
+		out[i++] = x;
+	}
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+===============================================================================
+ Name        : spi.c
+ Description : SPI0 master DMA driven frame output. See spi.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include "spi.h"
+#include "instr.h"
+
+// SPI register fields (UM10800 §17.6)
+#define SPI_CFG_ENABLE (1 << 0)
+#define SPI_CFG_MASTER (1 << 2)
+#define SPI_STAT_MSTIDLE (1 << 8)
+#define SPI_TXCTL_SSEL_N(n) (1 << (16 + (n)))	// 1 to deassert SSELn
+#define SPI_TXCTL_EOT (1 << 20)					// Deassert SSEL after this frame
+#define SPI_TXCTL_RXIGNORE (1 << 22)			// Don't store received data
+#define SPI_TXCTL_LEN(bits) (((bits) - 1) << 24)
+
+// Transfer control for frame bytes written to TXDAT: 8 bits, SSEL0 asserted,
+// nothing received
+#define SPI_TXCTL_FRAME (SPI_TXCTL_LEN(8) | SPI_TXCTL_RXIGNORE \
+		| SPI_TXCTL_SSEL_N(1) | SPI_TXCTL_SSEL_N(2) | SPI_TXCTL_SSEL_N(3))
+
+// Transmit chain: header descriptor lives in the channel's entry of the DMA
+// SRAM table, payload descriptors and then the end of transfer descriptor are
+// linked from it.
+static DMA_CHDESC_T txDesc[SPI_DMA_MAX_PAYLOAD_DESC + 1] __attribute__ ((aligned(16)));
+
+// Last byte of the frame with its transfer control, written to TXDATCTL by the
+// last descriptor
+static uint32_t eotWord;
+
+static volatile bool txBusy = false;
+
+static uint32_t bitRate;
+
+void spi_init (uint32_t bitrate)
+{
+	const uint32_t clk = Chip_Clock_GetSystemClockRate();
+	uint32_t div = (clk + bitrate - 1) / bitrate;
+
+	if (div < 2) {
+		div = 2;
+	}
+	bitRate = clk / div;
+
+	Chip_SPI_Init(LPC_SPI0);
+	LPC_SPI0->CFG = SPI_CFG_MASTER;	// Mode 0, MSB first, SSEL active low
+	LPC_SPI0->DLY = 0;
+	LPC_SPI0->DIV = div - 1;
+	LPC_SPI0->TXCTRL = SPI_TXCTL_FRAME;
+	LPC_SPI0->CFG = SPI_CFG_MASTER | SPI_CFG_ENABLE;
+
+	/* Setup channel for the following configuration:
+	   - SPI0 TX DMA request (peripheral request, no hardware trigger)
+	   - Lower priority than the ADC channel
+	   - Interrupt A fires on completion of the last descriptor */
+	Chip_DMA_EnableChannel(LPC_DMA, SPI_DMA_CH);
+	Chip_DMA_EnableIntChannel(LPC_DMA, SPI_DMA_CH);
+	Chip_DMA_SetupChannelConfig(LPC_DMA, SPI_DMA_CH,
+			(DMA_CFG_PERIPHREQEN
+					| DMA_CFG_TRIGBURST_SNGL
+					| DMA_CFG_CHPRIORITY(1)
+					));
+}
+
+uint32_t spi_get_bitrate (void)
+{
+	return bitRate;
+}
+
+/**
+ * @brief Transfer configuration for n bytes from memory to SPI0 TXDAT.
+ */
+static uint32_t tx_xfercfg (int n)
+{
+	return DMA_XFERCFG_CFGVALID
+			| DMA_XFERCFG_RELOAD
+			| DMA_XFERCFG_SWTRIG // no hardware trigger: start on peripheral request
+			| DMA_XFERCFG_WIDTH_8
+			| DMA_XFERCFG_SRCINC_1 // increment src by widthx1
+			| DMA_XFERCFG_DSTINC_0 // do not increment dst
+			| DMA_XFERCFG_XFERCOUNT(n);
+}
+
+bool spi_dma_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len)
+{
+	DMA_CHDESC_T head;
+	DMA_CHDESC_T *eot;
+	int i, n, ndesc;
+
+	if (txBusy) {
+		return false;
+	}
+	// One descriptor each for the header and every 1024 payload bytes
+	if (hdr_len > 1024 || len > SPI_DMA_MAX_PAYLOAD) {
+		return false;
+	}
+
+	// The last byte goes with end of transfer, by a 32 bit write to TXDATCTL
+	if (len > 0) {
+		eotWord = payload[--len];
+	} else {
+		eotWord = hdr[--hdr_len];
+	}
+	eotWord |= SPI_TXCTL_FRAME | SPI_TXCTL_EOT;
+
+	ndesc = (len + 1023) / 1024;
+
+	// Payload descriptors, max 1024 bytes each. Addresses are END addresses.
+	for (i = 0; i < ndesc; i++) {
+		n = (len - i*1024 > 1024) ? 1024 : len - i*1024;
+		txDesc[i].xfercfg = tx_xfercfg(n);
+		txDesc[i].source = DMA_ADDR(&payload[i*1024 + n - 1]);
+		txDesc[i].dest = DMA_ADDR(&LPC_SPI0->TXDAT);
+		txDesc[i].next = DMA_ADDR(&txDesc[i+1]);
+	}
+
+	eot = &txDesc[ndesc];
+	eot->xfercfg = DMA_XFERCFG_CFGVALID
+			| DMA_XFERCFG_SETINTA
+			| DMA_XFERCFG_SWTRIG
+			| DMA_XFERCFG_WIDTH_32
+			| DMA_XFERCFG_SRCINC_0
+			| DMA_XFERCFG_DSTINC_0
+			| DMA_XFERCFG_XFERCOUNT(1);
+	eot->source = DMA_ADDR(&eotWord);
+	eot->dest = DMA_ADDR(&LPC_SPI0->TXDATCTL);
+	eot->next = DMA_ADDR(0);
+
+	if (hdr_len > 0) {
+		head.xfercfg = tx_xfercfg(hdr_len);
+		head.source = DMA_ADDR(&hdr[hdr_len - 1]);
+		head.dest = DMA_ADDR(&LPC_SPI0->TXDAT);
+		head.next = DMA_ADDR(&txDesc[0]);
+	} else {
+		head = txDesc[0];
+	}
+
+	// The control bits are shared by TXCTRL and TXDATCTL, so the previous frame
+	// left EOT set: wait until its last byte is out, then clear it.
+	while ( (LPC_SPI0->STAT & SPI_STAT_MSTIDLE) == 0) {}
+	LPC_SPI0->TXCTRL = SPI_TXCTL_FRAME;
+
+	txBusy = true;
+	INSTR_BEGIN(INSTR_TX);
+	Chip_DMA_SetupTranChannel(LPC_DMA, SPI_DMA_CH, &head);
+	Chip_DMA_SetValidChannel(LPC_DMA, SPI_DMA_CH);
+	Chip_DMA_SetupChannelTransfer(LPC_DMA, SPI_DMA_CH, head.xfercfg);
+
+	return true;
+}
+
+bool spi_dma_busy (void)
+{
+	return txBusy;
+}
+
+void spi_dma_irq (void)
+{
+	Chip_DMA_ClearActiveIntAChannel(LPC_DMA, SPI_DMA_CH);
+	txBusy = false;
+	INSTR_END(INSTR_TX);
+}
@@ -0,0 +1,137 @@
+/*
+===============================================================================
+ Name        : transport.c
+ Description : Frame transport backends. See transport.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include <stddef.h>
+
+#include "transport.h"
+#include "uart.h"
+#include "spi.h"
+#include "systick.h"
+#include "instr.h"
+
+static bool uart_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len)
+{
+	uart_send_blocking(hdr, hdr_len);
+	uart_send_blocking(payload, len);
+	return true;
+}
+
+static bool uart_busy (void)
+{
+	return false;
+}
+
+static uint32_t uart_space (void)
+{
+	// Always accepts a frame, but send() only returns when it has been sent
+	return UART_DMA_MAX_PAYLOAD;
+}
+
+static uint32_t uart_dma_space (void)
+{
+	return uart_dma_busy() ? 0 : UART_DMA_MAX_PAYLOAD;
+}
+
+static uint32_t uart_rate (void)
+{
+	// 8N1: 10 bits per byte
+	return uart_get_baud() / 10;
+}
+
+static uint32_t spi_space (void)
+{
+	return spi_dma_busy() ? 0 : SPI_DMA_MAX_PAYLOAD;
+}
+
+static uint32_t spi_rate (void)
+{
+	// Back to back 8 bit frames, no delays
+	return spi_get_bitrate() / 8;
+}
+
+static const TRANSPORT_T backends[TRANSPORT_NUM] = {
+	{"uart", uart_send, uart_busy, uart_space, uart_rate},
+	{"uart_dma", uart_dma_send, uart_dma_busy, uart_dma_space, uart_rate},
+	{"spi", spi_dma_send, spi_dma_busy, spi_space, spi_rate},
+};
+
+static int current = TRANSPORT_UART;
+
+// Start time and expected duration of the last frame sent
+static uint32_t sendStart;
+static uint32_t sendCycles;
+
+bool transport_select (int id)
+{
+	if (id < 0 || id >= TRANSPORT_NUM) {
+		return false;
+	}
+	while (transport_busy()) {
+		INSTR_SLEEP();
+	}
+	current = id;
+	return true;
+}
+
+int transport_get (void)
+{
+	return current;
+}
+
+const char *transport_name (int id)
+{
+	if (id < 0 || id >= TRANSPORT_NUM) {
+		return NULL;
+	}
+	return backends[id].name;
+}
+
+bool transport_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len)
+{
+	uint32_t start = systick_now();
+
+	if ( ! backends[current].send(hdr, hdr_len, payload, len)) {
+		return false;
+	}
+	sendStart = start;
+	sendCycles = transport_tx_cycles(hdr_len + len);
+	return true;
+}
+
+bool transport_busy (void)
+{
+	return backends[current].busy();
+}
+
+uint32_t transport_space (void)
+{
+	return backends[current].space();
+}
+
+uint32_t transport_tx_cycles (uint32_t bytes)
+{
+	return (uint64_t)bytes * Chip_Clock_GetSystemClockRate() / backends[current].rate();
+}
+
+uint32_t transport_drain_cycles (void)
+{
+	uint32_t elapsed;
+
+	if ( ! transport_busy()) {
+		return 0;
+	}
+	elapsed = systick_elapsed(sendStart, systick_now());
+	return elapsed < sendCycles ? sendCycles - elapsed : 0;
+}
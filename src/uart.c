@@ -0,0 +1,430 @@
+/*
+===============================================================================
+ Name        : uart.c
+ Description : USART0 polled and DMA driven output. See uart.h.
+===============================================================================
+*/
+
+#if defined (__USE_LPCOPEN)
+#if defined(NO_BOARD_LIB)
+#include "chip.h"
+#else
+#include "board.h"
+#endif
+#endif
+
+#include "uart.h"
+#include "systick.h"
+#include "instr.h"
+#include "ramfunc.h"
+
+// Transmit chain: header descriptor lives in the channel's entry of the DMA
+// SRAM table, payload descriptors are linked from it.
+static DMA_CHDESC_T txDesc[UART_DMA_MAX_PAYLOAD_DESC] __attribute__ ((aligned(16)));
+
+static volatile bool txBusy = false;
+
+// Receive ring buffer, written by UART0_IRQHandler only
+static uint8_t rxBuf[UART_RX_BUF_SIZE];
+static volatile uint32_t rxHead = 0;
+static volatile uint32_t rxTail = 0;
+
+static UART_BAUD_CFG_T baudCfg;
+
+// If true print_byte() sleeps, woken by TXRDY, while the transmitter is full
+static bool txSleep = false;
+
+/**
+ * @brief Program the baud rate generator. Waits for the transmitter to be idle.
+ */
+static void uart_baud_apply (const UART_BAUD_CFG_T *cfg)
+{
+	while ( (Chip_UART_GetStatus(LPC_USART0) & UART_STAT_TXIDLE) == 0) {}
+
+	Chip_UART_Disable(LPC_USART0);
+	Chip_Clock_SetUARTClockDiv(cfg->clkdiv);
+	Chip_SYSCTL_SetUSARTFRGDivider(0xFF);
+	Chip_SYSCTL_SetUSARTFRGMultiplier(cfg->frgmult);
+	LPC_USART0->OSR = cfg->osr - 1;
+	LPC_USART0->BRG = cfg->brg - 1;
+	Chip_UART_Enable(LPC_USART0);
+
+	baudCfg = *cfg;
+}
+
+void uart_init (uint32_t baud)
+{
+	Chip_UART_Init(LPC_USART0);
+	Chip_UART_ConfigData(LPC_USART0,
+			UART_CFG_DATALEN_8
+			| UART_CFG_PARITY_NONE
+			| UART_CFG_STOPLEN_1);
+
+	uart_set_baud(baud, NULL);
+	Chip_UART_TXEnable(LPC_USART0);
+	Chip_UART_Enable(LPC_USART0);
+
+	Chip_UART_IntEnable(LPC_USART0, UART_INTEN_RXRDY);
+	NVIC_EnableIRQ(UART0_IRQn);
+}
+
+bool uart_baud_calc (uint32_t clk_hz, uint32_t baud, UART_BAUD_CFG_T *cfg)
+{
+	uint32_t osr, brg, brg_min;
+	int32_t best = UART_BAUD_MAX_ERROR_PPM + 1;
+
+	cfg->baud = 0;
+	cfg->error_ppm = 0;
+	if (baud == 0 || baud > UART_BAUD_MAX) {
+		return false;
+	}
+
+	// U_PCLK = clk_hz / (1 + frgmult/256) is in range clk_hz/2 to clk_hz. For each
+	// oversample rate try the first few BRG values that put U_PCLK in that range
+	// and pick the one with the smallest error after rounding frgmult. Higher
+	// oversample rates are preferred for the same error.
+	for (osr = 16; osr >= 5; osr--) {
+		brg_min = clk_hz / (2 * baud * osr) + 1;
+		for (brg = brg_min; brg < brg_min + 32 && brg <= 65536; brg++) {
+			uint32_t den = baud * osr * brg;
+			if (den > clk_hz) {
+				break;
+			}
+			// frgmult = 256 * clk_hz / den - 256, rounded
+			uint32_t mult = (uint32_t)((((uint64_t)clk_hz << 9) / den + 1) >> 1) - 256;
+			if (mult > 255) {
+				continue;
+			}
+			uint32_t actual = (uint32_t)(((uint64_t)clk_hz << 8) / ((256 + mult) * osr * brg));
+			int32_t err = (int32_t)(((int64_t)actual - baud) * 1000000 / baud);
+			if ((err < 0 ? -err : err) < (best < 0 ? -best : best)) {
+				best = err;
+				cfg->clkdiv = 1;
+				cfg->frgmult = mult;
+				cfg->osr = osr;
+				cfg->brg = brg;
+				cfg->baud = actual;
+				cfg->error_ppm = err;
+			}
+		}
+	}
+
+	return best <= UART_BAUD_MAX_ERROR_PPM && best >= -UART_BAUD_MAX_ERROR_PPM;
+}
+
+uint32_t uart_set_baud (uint32_t baud, int32_t *error_ppm)
+{
+	UART_BAUD_CFG_T cfg;
+
+	if ( ! uart_baud_calc(Chip_Clock_GetMainClockRate(), baud, &cfg)) {
+		return 0;
+	}
+	uart_baud_apply(&cfg);
+	if (error_ppm != NULL) {
+		*error_ppm = cfg.error_ppm;
+	}
+	return cfg.baud;
+}
+
+uint32_t uart_get_baud (void)
+{
+	return baudCfg.baud;
+}
+
+/**
+ * @brief Send a 32 bit value little-endian.
+ */
+static void print_u32le (uint32_t v)
+{
+	print_byte(v);
+	print_byte(v >> 8);
+	print_byte(v >> 16);
+	print_byte(v >> 24);
+}
+
+bool uart_baud_handshake (uint32_t baud)
+{
+	UART_BAUD_CFG_T old = baudCfg;
+	UART_BAUD_CFG_T cfg;
+	uint32_t timeout, start, elapsed = 0;
+
+	// Don't change rate in the middle of a frame
+	while (txBusy) {
+		INSTR_SLEEP();
+	}
+
+	if ( ! uart_baud_calc(Chip_Clock_GetMainClockRate(), baud, &cfg)) {
+		print_byte('n');
+		print_u32le(cfg.baud);
+		print_u32le(cfg.error_ppm);
+		return false;
+	}
+	print_byte('b');
+	print_u32le(cfg.baud);
+	print_u32le(cfg.error_ppm);
+
+	// Switch after the reply has been sent, discard anything received at the old rate
+	uart_baud_apply(&cfg);
+	rxTail = rxHead;
+
+	// Wait for confirmation at the new rate
+	timeout = (Chip_Clock_GetSystemClockRate() / 1000) * UART_BAUD_CONFIRM_MS;
+	start = systick_now();
+	while (elapsed < timeout) {
+		if (uart_getc() == 'K') {
+			print_byte('k');
+			return true;
+		}
+		uint32_t now = systick_now();
+		elapsed += systick_elapsed(start, now);
+		start = now;
+	}
+
+	uart_baud_apply(&old);
+	return false;
+}
+
+int uart_getc (void)
+{
+	uint32_t tail = rxTail;
+	int c;
+
+	if (tail == rxHead) {
+		return -1;
+	}
+	c = rxBuf[tail & (UART_RX_BUF_SIZE-1)];
+	rxTail = tail + 1;
+	return c;
+}
+
+/**
+ * @brief	USART0 interrupt handler. Receive bytes into rxBuf, wake print_byte().
+ * @return	None
+ */
+void UART0_IRQHandler (void)
+{
+	INSTR_ISR_BEGIN(INSTR_UART_ISR);
+	// TXRDY is only enabled to wake print_byte()
+	if (Chip_UART_GetStatus(LPC_USART0) & UART_STAT_TXRDY) {
+		Chip_UART_IntDisable(LPC_USART0, UART_INTEN_TXRDY);
+	}
+	while (Chip_UART_GetStatus(LPC_USART0) & UART_STAT_RXRDY) {
+		uint8_t c = Chip_UART_ReadByte(LPC_USART0);
+		uint32_t head = rxHead;
+		// Drop bytes if the buffer is full
+		if (head - rxTail < UART_RX_BUF_SIZE) {
+			rxBuf[head & (UART_RX_BUF_SIZE-1)] = c;
+			rxHead = head + 1;
+		}
+	}
+	INSTR_ISR_END(INSTR_UART_ISR);
+}
+
+void print_byte (uint8_t n) {
+	//Chip_UART_SendBlocking(LPC_USART0, &n, 1);
+
+	// Wait until data can be written to FIFO (TXRDY==1). If txSleep that's a
+	// byte time of sleep: the TXRDY interrupt is taken, so sets the event
+	// register, even if TXRDY has been set since the check.
+	while ( (Chip_UART_GetStatus(LPC_USART0) & UART_STAT_TXRDY) == 0) {
+		if (txSleep) {
+			Chip_UART_IntEnable(LPC_USART0, UART_INTEN_TXRDY);
+			INSTR_SLEEP();
+		}
+	}
+
+	Chip_UART_SendByte(LPC_USART0, n);
+}
+
+void uart_tx_sleep (bool sleep)
+{
+	txSleep = sleep;
+}
+
+void print_string (const char *s) {
+	while (*s) {
+		print_byte(*s++);
+	}
+}
+
+// Powers of 10 above the 4 digits fmt_decimal() does by reciprocal multiply
+static const uint32_t pow10[6] = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000
+};
+
+HOT_FUNC(fmt_decimal)
+int fmt_decimal (char *buf, int n)
+{
+	char *p = buf;
+	uint32_t u = n, q;
+	int i, len;
+
+	// Handle negative numbers. -INT_MIN is fine unsigned.
+	if (n < 0) {
+		*p++ = '-';
+		u = -u;
+	}
+
+	// Digits above the last 4: count subtractions of each power of 10, at most 9
+	// each. Leading zeros are skipped.
+	len = 1;
+	if (u >= 10000) {
+		for (i = 0; i < 6; i++) {
+			char d = '0';
+			while (u >= pow10[i]) {
+				u -= pow10[i];
+				d++;
+			}
+			if (d != '0' || p != buf + (n < 0)) {
+				*p++ = d;
+			}
+		}
+		len = 4;
+	} else if (u >= 1000) {
+		len = 4;
+	} else if (u >= 100) {
+		len = 3;
+	} else if (u >= 10) {
+		len = 2;
+	}
+
+	// Last digits right to left. u/10 == (u * 0xCCCD) >> 19 for u < 81920, and a
+	// 32x32 multiply is single cycle where the (ROM) divide is a call.
+	for (i = len; i > 0; i--) {
+		q = (u * 0xCCCD) >> 19;
+		p[i - 1] = '0' + (u - q * 10);
+		u = q;
+	}
+
+	return p + len - buf;
+}
+
+int fmt_decimal_div (char *buf, int n)
+{
+	char tmp[10];
+	int i = 0, len = 0;
+
+	// Special case of n==0
+	if (n == 0) {
+		buf[0] = '0';
+		return 1;
+	}
+
+	// Handle negative numbers
+	if (n < 0) {
+		buf[len++] = '-';
+		n = -n;
+	}
+
+	// Use modulo 10 to get least significant digit.
+	// Then /10 to shift digits right and get next least significant digit.
+	while (n > 0) {
+		tmp[i++] = '0' + n%10;
+		n /= 10;
+	}
+
+	// Output digits in reverse order
+	do {
+		buf[len++] = tmp[--i];
+	} while (i>0);
+
+	return len;
+}
+
+HOT_FUNC(print_decimal)
+void print_decimal (int n) {
+	char buf[UART_DEC_MAX];
+	int i, len;
+
+	len = fmt_decimal(buf, n);
+	for (i = 0; i < len; i++) {
+		print_byte(buf[i]);
+	}
+}
+
+void uart_send_blocking (const uint8_t *buf, int len)
+{
+	int i;
+	for (i = 0; i < len; i++) {
+		print_byte(buf[i]);
+	}
+}
+
+void uart_dma_init (void)
+{
+	/* Setup channel for the following configuration:
+	   - USART0 TX DMA request (peripheral request, no hardware trigger)
+	   - Lower priority than the ADC channel
+	   - Interrupt A fires on completion of the last descriptor */
+	Chip_DMA_EnableChannel(LPC_DMA, UART_DMA_CH);
+	Chip_DMA_EnableIntChannel(LPC_DMA, UART_DMA_CH);
+	Chip_DMA_SetupChannelConfig(LPC_DMA, UART_DMA_CH,
+			(DMA_CFG_PERIPHREQEN
+					| DMA_CFG_TRIGBURST_SNGL
+					| DMA_CFG_CHPRIORITY(1)
+					));
+}
+
+/**
+ * @brief Transfer configuration for n bytes from memory to USART0 TXDATA.
+ */
+static uint32_t tx_xfercfg (int n, bool last)
+{
+	return DMA_XFERCFG_CFGVALID
+			| (last ? DMA_XFERCFG_SETINTA : DMA_XFERCFG_RELOAD)
+			| DMA_XFERCFG_SWTRIG // no hardware trigger: start on peripheral request
+			| DMA_XFERCFG_WIDTH_8
+			| DMA_XFERCFG_SRCINC_1 // increment src by widthx1
+			| DMA_XFERCFG_DSTINC_0 // do not increment dst
+			| DMA_XFERCFG_XFERCOUNT(n);
+}
+
+bool uart_dma_send (const uint8_t *hdr, int hdr_len, const uint8_t *payload, int len)
+{
+	DMA_CHDESC_T head;
+	int i, n, ndesc;
+
+	if (txBusy) {
+		return false;
+	}
+	// One descriptor each for the header and every 1024 payload bytes
+	if (hdr_len > 1024 || len > UART_DMA_MAX_PAYLOAD) {
+		return false;
+	}
+
+	ndesc = (len + 1023) / 1024;
+
+	// Payload descriptors, max 1024 bytes each. Addresses are END addresses.
+	for (i = 0; i < ndesc; i++) {
+		n = (len - i*1024 > 1024) ? 1024 : len - i*1024;
+		txDesc[i].xfercfg = tx_xfercfg(n, i == ndesc-1);
+		txDesc[i].source = DMA_ADDR(&payload[i*1024 + n - 1]);
+		txDesc[i].dest = DMA_ADDR(&LPC_USART0->TXDATA);
+		txDesc[i].next = (i == ndesc-1) ? DMA_ADDR(0) : DMA_ADDR(&txDesc[i+1]);
+	}
+
+	head.xfercfg = tx_xfercfg(hdr_len, ndesc == 0);
+	head.source = DMA_ADDR(&hdr[hdr_len - 1]);
+	head.dest = DMA_ADDR(&LPC_USART0->TXDATA);
+	head.next = (ndesc == 0) ? DMA_ADDR(0) : DMA_ADDR(&txDesc[0]);
+
+	txBusy = true;
+	INSTR_BEGIN(INSTR_TX);
+	Chip_DMA_SetupTranChannel(LPC_DMA, UART_DMA_CH, &head);
+	Chip_DMA_SetValidChannel(LPC_DMA, UART_DMA_CH);
+	Chip_DMA_SetupChannelTransfer(LPC_DMA, UART_DMA_CH, head.xfercfg);
+
+	return true;
+}
+
+bool uart_dma_busy (void)
+{
+	return txBusy;
+}
+
+void uart_dma_irq (void)
+{
+	Chip_DMA_ClearActiveIntAChannel(LPC_DMA, UART_DMA_CH);
+	txBusy = false;
+	INSTR_END(INSTR_TX);
+}